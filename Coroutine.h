@@ -0,0 +1,440 @@
+#ifndef _CONCURRENCY_COROUTINE_H_
+#define _CONCURRENCY_COROUTINE_H_ 1
+
+#include "ThreadManager.h"
+
+#ifdef CONCURRENCY_HAS_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "Futex.h"
+
+namespace concurrency {
+namespace detail {
+/**
+ * Callable queued to resume a coroutine: a bare handle, stored inline in the
+ * pooled task so that a resumption costs no allocation.
+ */
+struct CoroutineResume
+{
+    std::coroutine_handle<> handle;
+
+    void operator()() const { handle.resume(); }
+};
+}
+
+template <class T>
+class Task;
+
+/**
+ * Awaitable returned by ThreadManager::schedule().
+ *
+ * 协程调度等待体：挂起协程并把恢复操作放入线程管理器的队列
+ *
+ * Off the workers the resumption is queued with the BLOCK policy: a full
+ * queue blocks the awaiting thread, and co_await rethrows in the coroutine
+ * if the manager is not started.  On a worker of the manager a full queue
+ * does not suspend at all, the coroutine keeps running on that worker (it
+ * is already where it should be).  A resumption that expires or is removed
+ * is handed to the expire callback like any task; the coroutine stays
+ * suspended until that Runnable is run.
+ */
+class ScheduleAwaiter
+{
+public:
+    explicit ScheduleAwaiter(ThreadManager &manager) noexcept : manager_(manager) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        // a worker may resume and destroy the frame holding this awaiter
+        // before submit() returns, nothing of it is touched afterwards
+        ThreadManager &manager = manager_;
+        if (manager.onWorkerThread())
+        {
+            return manager.submit(detail::CoroutineResume{handle}, ThreadManager::REJECT).valid();
+        }
+        manager.submit(detail::CoroutineResume{handle}, ThreadManager::BLOCK);
+        return true;
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    friend void spawn(ThreadManager &manager, Task<void> task);
+
+    /**
+   * Queues a resumption that must not be lost: CALLER_RUNS on a worker,
+   * where blocking is not possible, BLOCK elsewhere; either runs it or throws.
+   */
+    static void start(ThreadManager &manager, std::coroutine_handle<> handle)
+    {
+        manager.submit(detail::CoroutineResume{handle},
+                       manager.onWorkerThread() ? ThreadManager::CALLER_RUNS : ThreadManager::BLOCK);
+    }
+
+    ThreadManager &manager_;
+};
+
+inline ScheduleAwaiter ThreadManager::schedule()
+{
+    return ScheduleAwaiter(*this);
+}
+
+namespace detail {
+/**
+ * Type independent part of a Task promise: the awaiting coroutine and the
+ * exception thrown by the body.
+ */
+class CoroutinePromiseBase
+{
+public:
+    /**
+   * Resumes the awaiting coroutine on the same thread (symmetric transfer,
+   * no stack growth and no queueing).
+   */
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        template <class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+        {
+            return handle.promise().continuation_;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+    std::coroutine_handle<> continuation_ = std::noop_coroutine();
+    std::exception_ptr exception_;
+};
+
+template <class T>
+class CoroutinePromise : public CoroutinePromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+
+    template <class U>
+    void return_value(U &&value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+
+    T result()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class CoroutinePromise<void> : public CoroutinePromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void result()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+    }
+};
+}
+
+/**
+ * Lazily started coroutine producing a T, awaited with co_await.
+ *
+ * 协程任务：惰性启动，被co_await时开始执行，完成后直接切换回等待者
+ *
+ * The body starts when the Task is awaited, on the awaiting thread, and
+ * hands the result back by resuming the awaiting coroutine directly, so a
+ * chain of Tasks runs without touching the queues.  The body moves to a
+ * worker with co_await manager.schedule().  A Task is awaited at most once;
+ * spawn() and syncWait() start one from ordinary code.  Destroying a Task
+ * that was never awaited destroys the coroutine without running it.
+ */
+template <class T = void>
+class Task
+{
+    static_assert(!std::is_reference<T>::value, "Task can not return a reference");
+
+public:
+    typedef detail::CoroutinePromise<T> promise_type;
+
+    Task() noexcept : coroutine_(nullptr) {}
+
+    Task(Task &&other) noexcept : coroutine_(std::exchange(other.coroutine_, nullptr)) {}
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (coroutine_)
+            {
+                coroutine_.destroy();
+            }
+            coroutine_ = std::exchange(other.coroutine_, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (coroutine_)
+        {
+            coroutine_.destroy();
+        }
+    }
+
+    /**
+   * \returns false for a default constructed or moved from Task
+   */
+    bool valid() const noexcept { return static_cast<bool>(coroutine_); }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        coroutine_.promise().continuation_ = awaiting;
+        return coroutine_;
+    }
+
+    /**
+   * \returns the value returned by the body; rethrows its exception
+   */
+    T await_resume() { return coroutine_.promise().result(); }
+
+private:
+    friend class detail::CoroutinePromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> coroutine) noexcept : coroutine_(coroutine) {}
+
+    std::coroutine_handle<promise_type> coroutine_;
+};
+
+namespace detail {
+template <class T>
+Task<T> CoroutinePromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<CoroutinePromise<T>>::from_promise(*this));
+}
+
+inline Task<void> CoroutinePromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<CoroutinePromise<void>>::from_promise(*this));
+}
+
+/**
+ * Coroutine owning itself, used by spawn(): started by a queued resumption,
+ * its frame is freed when the body returns.
+ */
+class DetachedCoroutine
+{
+public:
+    struct promise_type
+    {
+        DetachedCoroutine get_return_object() noexcept
+        {
+            return DetachedCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        std::suspend_never final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept
+        {
+            try
+            {
+                throw;
+            }
+            catch (const std::exception &e)
+            {
+                printf("[ERROR] spawn() task raised an exception: %s", e.what());
+            }
+            catch (...)
+            {
+                printf("[ERROR] spawn() task raised an unknown exception");
+            }
+        }
+    };
+
+    std::coroutine_handle<promise_type> coroutine;
+
+private:
+    explicit DetachedCoroutine(std::coroutine_handle<promise_type> handle) noexcept : coroutine(handle) {}
+};
+
+inline DetachedCoroutine runDetached(Task<void> task)
+{
+    co_await task;
+}
+
+/**
+ * Coroutine run by syncWait(): signals done once the awaited Task completed.
+ */
+class SyncWaitCoroutine
+{
+public:
+    struct promise_type
+    {
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept
+            {
+                // the waiting thread destroys the frame as soon as it sees done,
+                // the wake-up only names the address
+                std::atomic<uint32_t> &done = handle.promise().done_;
+                done.store(1, std::memory_order_release);
+                Futex::wakeAll(done);
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        SyncWaitCoroutine get_return_object() noexcept
+        {
+            return SyncWaitCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+        std::atomic<uint32_t> done_{0};
+        std::exception_ptr exception_;
+    };
+
+    SyncWaitCoroutine(const SyncWaitCoroutine &) = delete;
+    SyncWaitCoroutine &operator=(const SyncWaitCoroutine &) = delete;
+
+    ~SyncWaitCoroutine() { coroutine_.destroy(); }
+
+    /**
+   * Starts the body on the calling thread and blocks until it completed.
+   */
+    void run()
+    {
+        coroutine_.resume();
+        std::atomic<uint32_t> &done = coroutine_.promise().done_;
+        while (done.load(std::memory_order_acquire) == 0)
+        {
+            Futex::wait(done, 0);
+        }
+        if (coroutine_.promise().exception_)
+        {
+            std::rethrow_exception(coroutine_.promise().exception_);
+        }
+    }
+
+private:
+    explicit SyncWaitCoroutine(std::coroutine_handle<promise_type> handle) noexcept : coroutine_(handle) {}
+
+    std::coroutine_handle<promise_type> coroutine_;
+};
+
+template <class T>
+SyncWaitCoroutine runSyncWait(Task<T> &task, std::optional<T> &value)
+{
+    value.emplace(co_await task);
+}
+
+inline SyncWaitCoroutine runSyncWait(Task<void> &task)
+{
+    co_await task;
+}
+}
+
+/**
+ * Starts a Task on a worker thread of manager and lets it run to completion
+ * on its own; an exception escaping it is logged.
+ *
+ * 在工作线程上启动协程任务，不等待其完成
+ *
+ * The start is queued with the BLOCK policy; on a worker thread, where
+ * blocking is not possible, a full queue runs the Task inline up to its
+ * first suspension instead (CALLER_RUNS).
+ *
+ * \throws std::exception if the start can not be queued, the Task is then
+ * destroyed without running
+ */
+inline void spawn(ThreadManager &manager, Task<void> task)
+{
+    std::coroutine_handle<detail::DetachedCoroutine::promise_type> coroutine = detail::runDetached(std::move(task)).coroutine;
+    try
+    {
+        ScheduleAwaiter::start(manager, coroutine);
+    }
+    catch (...)
+    {
+        coroutine.destroy();
+        throw;
+    }
+}
+
+/**
+ * Runs a Task, starting on the calling thread, and blocks until it
+ * completed.  Must not be called on a worker thread whose Task needs that
+ * worker to make progress.
+ *
+ * 同步等待协程任务完成并返回其结果
+ *
+ * \returns the value returned by the Task; rethrows its exception
+ */
+template <class T>
+T syncWait(Task<T> task)
+{
+    std::optional<T> value;
+    {
+        detail::SyncWaitCoroutine wait = detail::runSyncWait(task, value);
+        wait.run();
+    }
+    return std::move(*value);
+}
+
+inline void syncWait(Task<void> task)
+{
+    detail::SyncWaitCoroutine wait = detail::runSyncWait(task);
+    wait.run();
+}
+}
+
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+#include "CpuTopology.h"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace concurrency {
+namespace {
+/**
+ * 机器拓扑，首次使用时探测一次
+ */
+struct Topology {
+  std::vector<std::vector<int>> nodes;
+  // indexed by cpu, -1 for cpus the process may not run on
+  std::vector<int> nodeOfCpu;
+
+  void addNode(const std::vector<int> &cpus) {
+    if (cpus.empty()) {
+      return;
+    }
+    for (int cpu : cpus) {
+      if (static_cast<size_t>(cpu) >= nodeOfCpu.size()) {
+        nodeOfCpu.resize(cpu + 1, -1);
+      }
+      nodeOfCpu[cpu] = static_cast<int>(nodes.size());
+    }
+    nodes.push_back(cpus);
+  }
+
+  /**
+   * Single node fallback holding cpus, or the first hardware_concurrency() cpus.
+   */
+  void addDefaultNode(std::vector<int> cpus) {
+    if (cpus.empty()) {
+      unsigned count = std::max(1u, std::thread::hardware_concurrency());
+      for (unsigned cpu = 0; cpu < count; cpu++) {
+        cpus.push_back(static_cast<int>(cpu));
+      }
+    }
+    addNode(cpus);
+  }
+};
+
+#if defined(_WIN32)
+
+void discover(Topology &topology) {
+  DWORD_PTR process = 0, system = 0;
+  if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+    process = 0;
+  }
+
+  ULONG highest = 0;
+  if (GetNumaHighestNodeNumber(&highest)) {
+    for (ULONG node = 0; node <= highest; node++) {
+      ULONGLONG mask = 0;
+      if (!GetNumaNodeProcessorMask(static_cast<UCHAR>(node), &mask)) {
+        continue;
+      }
+      std::vector<int> cpus;
+      for (int cpu = 0; cpu < 64; cpu++) {
+        if ((mask & process) & (1ULL << cpu)) {
+          cpus.push_back(cpu);
+        }
+      }
+      topology.addNode(cpus);
+    }
+  }
+
+  if (topology.nodes.empty()) {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < 64; cpu++) {
+      if (process & (1ULL << cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+    topology.addDefaultNode(cpus);
+  }
+}
+
+#elif defined(__linux__)
+
+/**
+ * Parses a sysfs cpu list such as "0-3,8-11".
+ */
+std::vector<int> parseCpuList(const char *list) {
+  std::vector<int> cpus;
+  const char *p = list;
+  while (*p >= '0' && *p <= '9') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(static_cast<int>(cpu));
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return cpus;
+}
+
+void discover(Topology &topology) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+  auto isAllowed = [&](int cpu) { return !masked || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)); };
+
+  std::vector<int> nodeIds;
+  if (DIR *dir = opendir("/sys/devices/system/node")) {
+    while (struct dirent *entry = readdir(dir)) {
+      int id;
+      if (sscanf(entry->d_name, "node%d", &id) == 1) {
+        nodeIds.push_back(id);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(nodeIds.begin(), nodeIds.end());
+
+  for (int id : nodeIds) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+      continue;
+    }
+    char list[4096];
+    std::vector<int> cpus;
+    if (fgets(list, sizeof(list), file)) {
+      cpus = parseCpuList(list);
+    }
+    fclose(file);
+    // memory-only nodes and nodes outside of the process mask have no cpu to offer
+    cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](int cpu) { return !isAllowed(cpu); }), cpus.end());
+    topology.addNode(cpus);
+  }
+
+  if (topology.nodes.empty()) {
+    std::vector<int> cpus;
+    for (int cpu = 0; masked && cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    topology.addDefaultNode(cpus);
+  }
+}
+
+#else
+
+void discover(Topology &topology) {
+  topology.addDefaultNode(std::vector<int>());
+}
+
+#endif
+
+const Topology &topology() {
+  static const Topology instance = []() {
+    Topology result;
+    discover(result);
+    return result;
+  }();
+  return instance;
+}
+}
+
+size_t CpuTopology::cpuCount() {
+  size_t count = 0;
+  for (const auto &cpus : topology().nodes) {
+    count += cpus.size();
+  }
+  return std::max(count, static_cast<size_t>(1));
+}
+
+size_t CpuTopology::nodeCount() {
+  return topology().nodes.size();
+}
+
+const std::vector<int> &CpuTopology::nodeCpus(size_t node) {
+  static const std::vector<int> none;
+  return node < topology().nodes.size() ? topology().nodes[node] : none;
+}
+
+int CpuTopology::nodeOf(int cpu) {
+  const std::vector<int> &nodeOfCpu = topology().nodeOfCpu;
+  return cpu >= 0 && static_cast<size_t>(cpu) < nodeOfCpu.size() ? nodeOfCpu[cpu] : -1;
+}
+
+int CpuTopology::nodeOf(const std::vector<int> &cpus) {
+  int node = cpus.empty() ? -1 : nodeOf(cpus.front());
+  for (int cpu : cpus) {
+    if (nodeOf(cpu) != node) {
+      return -1;
+    }
+  }
+  return node;
+}
+
+int CpuTopology::currentNode() {
+#if defined(_WIN32)
+  return nodeOf(static_cast<int>(GetCurrentProcessorNumber()));
+#elif defined(__linux__)
+  return nodeOf(sched_getcpu());
+#else
+  return -1;
+#endif
+}
+
+bool CpuTopology::bindCurrentThread(const std::vector<int> &cpus) {
+  if (cpus.empty()) {
+    return false;
+  }
+#if defined(_WIN32)
+  DWORD_PTR mask = 0;
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+      mask |= static_cast<DWORD_PTR>(1) << cpu;
+    }
+  }
+  return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+}
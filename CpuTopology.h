@@ -0,0 +1,59 @@
+#ifndef _CONCURRENCY_CPUTOPOLOGY_H_
+#define _CONCURRENCY_CPUTOPOLOGY_H_ 1
+
+#include <cstddef>
+#include <vector>
+
+namespace concurrency {
+/**
+ * CPUs and NUMA nodes of the machine, discovered once on first use, and
+ * binding of the calling thread to a set of CPUs.
+ *
+ * CPU与NUMA节点拓扑，以及当前线程的CPU亲和性设置
+ *
+ * Linux reads /sys/devices/system/node, Windows asks the NUMA API (processor
+ * group 0 only).  Elsewhere, or when the information is missing, the machine
+ * is a single node holding every CPU and affinity is not supported.
+ */
+class CpuTopology
+{
+public:
+    /**
+   * Number of CPUs the process may run on, at least 1.
+   */
+    static size_t cpuCount();
+
+    /**
+   * Number of NUMA nodes with CPUs, at least 1.
+   */
+    static size_t nodeCount();
+
+    /**
+   * CPUs of the nodeCount() nodes, numbered from 0 in the order they were found.
+   */
+    static const std::vector<int> &nodeCpus(size_t node);
+
+    /**
+   * \returns the node of cpu, -1 if unknown
+   */
+    static int nodeOf(int cpu);
+
+    /**
+   * \returns the node all of cpus belong to, -1 if they span several nodes
+   */
+    static int nodeOf(const std::vector<int> &cpus);
+
+    /**
+   * \returns the node of the CPU the calling thread is running on, -1 if unknown
+   */
+    static int currentNode();
+
+    /**
+   * Restricts the calling thread to cpus.
+   * \returns false if the platform does not support it or refused
+   */
+    static bool bindCurrentThread(const std::vector<int> &cpus);
+};
+}
+
+#endif
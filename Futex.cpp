@@ -0,0 +1,125 @@
+#include "Futex.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#endif
+
+namespace concurrency {
+#if defined(_WIN32)
+
+void Futex::wait(const std::atomic<uint32_t> &word, uint32_t expected) {
+  WaitOnAddress(const_cast<std::atomic<uint32_t> *>(&word), &expected, sizeof(expected), INFINITE);
+}
+
+bool Futex::waitFor(const std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout) {
+  if (timeout.count() <= 0) {
+    return false;
+  }
+  // round up so that a short timeout does not turn into a busy loop
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout + std::chrono::nanoseconds(999999));
+  if (WaitOnAddress(const_cast<std::atomic<uint32_t> *>(&word), &expected, sizeof(expected),
+                    static_cast<DWORD>(ms.count()))) {
+    return true;
+  }
+  return GetLastError() != ERROR_TIMEOUT;
+}
+
+void Futex::wakeOne(const std::atomic<uint32_t> &word) {
+  WakeByAddressSingle(const_cast<std::atomic<uint32_t> *>(&word));
+}
+
+void Futex::wakeAll(const std::atomic<uint32_t> &word) {
+  WakeByAddressAll(const_cast<std::atomic<uint32_t> *>(&word));
+}
+
+#elif defined(__linux__)
+
+namespace {
+long futex(const std::atomic<uint32_t> &word, int op, uint32_t value, const struct timespec *timeout) {
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32 bit integer");
+  return syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&word), op, value, timeout, nullptr, 0);
+}
+}
+
+void Futex::wait(const std::atomic<uint32_t> &word, uint32_t expected) {
+  futex(word, FUTEX_WAIT_PRIVATE, expected, nullptr);
+}
+
+bool Futex::waitFor(const std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout) {
+  if (timeout.count() <= 0) {
+    return false;
+  }
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+  ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+  // FUTEX_WAIT takes a relative timeout
+  return !(futex(word, FUTEX_WAIT_PRIVATE, expected, &ts) == -1 && errno == ETIMEDOUT);
+}
+
+void Futex::wakeOne(const std::atomic<uint32_t> &word) {
+  futex(word, FUTEX_WAKE_PRIVATE, 1, nullptr);
+}
+
+void Futex::wakeAll(const std::atomic<uint32_t> &word) {
+  futex(word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);
+}
+
+#else
+
+namespace {
+/**
+ * Parking lot fallback: words hash onto a fixed set of buckets, so a wake
+ * always notifies every waiter of the bucket.
+ */
+struct Bucket {
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+Bucket &bucketFor(const void *address) {
+  static Bucket buckets[64];
+  return buckets[(std::hash<const void *>()(address) >> 4) % 64];
+}
+}
+
+void Futex::wait(const std::atomic<uint32_t> &word, uint32_t expected) {
+  Bucket &bucket = bucketFor(&word);
+  std::unique_lock<std::mutex> lock(bucket.mutex);
+  if (word.load() == expected) {
+    bucket.condition.wait(lock);
+  }
+}
+
+bool Futex::waitFor(const std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout) {
+  Bucket &bucket = bucketFor(&word);
+  std::unique_lock<std::mutex> lock(bucket.mutex);
+  if (word.load() != expected) {
+    return true;
+  }
+  return bucket.condition.wait_for(lock, timeout) == std::cv_status::no_timeout;
+}
+
+void Futex::wakeOne(const std::atomic<uint32_t> &word) {
+  wakeAll(word);
+}
+
+void Futex::wakeAll(const std::atomic<uint32_t> &word) {
+  Bucket &bucket = bucketFor(&word);
+  std::lock_guard<std::mutex> lock(bucket.mutex);
+  bucket.condition.notify_all();
+}
+
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef _CONCURRENCY_FUTEX_H_
+#define _CONCURRENCY_FUTEX_H_ 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#endif
+
+namespace concurrency {
+/**
+ * Hints the processor that the thread is spinning in a wait loop.
+ *
+ * 自旋等待提示（x86 pause / ARM yield）
+ */
+inline void cpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Wait/wake on the address of a 32 bit atomic word: futex on Linux,
+ * WaitOnAddress on Windows, a hashed table of condition variables elsewhere.
+ *
+ * 基于地址的等待与唤醒：Linux使用futex，Windows使用WaitOnAddress
+ *
+ * Waits may return spuriously, callers always re-check their condition.
+ */
+class Futex
+{
+public:
+    /**
+   * Blocks while word holds expected.
+   */
+    static void wait(const std::atomic<uint32_t> &word, uint32_t expected);
+
+    /**
+   * Blocks while word holds expected, at most for timeout.
+   * \returns false if the timeout elapsed
+   */
+    static bool waitFor(const std::atomic<uint32_t> &word, uint32_t expected, std::chrono::nanoseconds timeout);
+
+    /** Wakes up one thread blocked on word. */
+    static void wakeOne(const std::atomic<uint32_t> &word);
+
+    /** Wakes up every thread blocked on word. */
+    static void wakeAll(const std::atomic<uint32_t> &word);
+};
+}
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef _CONCURRENCY_FUTURE_H_
+#define _CONCURRENCY_FUTURE_H_ 1
+
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "ThreadManager.h"
+
+namespace concurrency {
+/**
+ * Type independent part of a task result: the exception thrown by the task.
+ */
+class FutureResultBase
+{
+public:
+    std::exception_ptr exception_;
+};
+
+/**
+ * Result of an async() task, stored inside the task's callable.
+ *
+ * 异步任务的结果，与可调用对象一起存放在任务对象中
+ */
+template <class R>
+class FutureResult : public FutureResultBase
+{
+public:
+    template <class F>
+    void run(F &f)
+    {
+        try
+        {
+            value_.emplace(f());
+        }
+        catch (...)
+        {
+            exception_ = std::current_exception();
+        }
+    }
+
+    /**
+   * Calls g with the value, for then().
+   */
+    template <class G>
+    decltype(auto) applyTo(G &g) { return g(std::move(*value_)); }
+
+    R take()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<R> value_;
+};
+
+template <>
+class FutureResult<void> : public FutureResultBase
+{
+public:
+    template <class F>
+    void run(F &f)
+    {
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            exception_ = std::current_exception();
+        }
+    }
+
+    template <class G>
+    decltype(auto) applyTo(G &g) { return g(); }
+
+    void take()
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+    }
+};
+
+/**
+ * Value type of the Future returned by Future<R>::then() for continuation G
+ */
+template <class G, class R>
+using ThenResultOf = typename std::decay<decltype(std::declval<FutureResult<R> &>().applyTo(std::declval<typename std::decay<G>::type &>()))>::type;
+
+/**
+ * Callable stored in the task by ThreadManager::async().
+ */
+template <class F, class R>
+struct AsyncCall
+{
+    template <class Arg>
+    explicit AsyncCall(Arg &&f) : function(std::forward<Arg>(f)) {}
+
+    void operator()() { result.run(function); }
+
+    F function;
+    FutureResult<R> result;
+};
+
+/**
+ * Handle on the result of a task added by ThreadManager::async().
+ *
+ * 异步任务结果的句柄：仅可移动，get()之后失效
+ *
+ * Waiting spins on nothing and takes no lock: it blocks on the task's futex
+ * word, and the completing worker only makes a wake-up call when somebody is
+ * actually waiting.  Like add(), waiting from a worker thread of the same
+ * manager can deadlock if no other worker is left to run the task.
+ */
+template <class R>
+class Future
+{
+public:
+    Future() noexcept : task_(nullptr) {}
+
+    Future(Future &&other) noexcept : task_(other.task_) { other.task_ = nullptr; }
+
+    Future &operator=(Future &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            task_ = other.task_;
+            other.task_ = nullptr;
+        }
+        return *this;
+    }
+
+    Future(const Future &) = delete;
+    Future &operator=(const Future &) = delete;
+
+    ~Future() { reset(); }
+
+    /**
+   * \returns false for a default constructed, moved from or consumed Future
+   */
+    bool valid() const noexcept { return task_ != nullptr; }
+
+    /**
+   * \returns true once the task ran (or was abandoned), never blocks
+   */
+    bool isReady() const
+    {
+        check();
+        return task_->isReady();
+    }
+
+    /**
+   * Blocks until the result is available.
+   */
+    void wait() const
+    {
+        check();
+        task_->wait();
+    }
+
+    /**
+   * Blocks until the result is available, at most timeout milliseconds.
+   * \returns false on timeout
+   */
+    bool waitFor(int64_t timeout) const
+    {
+        check();
+        return task_->waitFor(timeout);
+    }
+
+    /**
+   * Waits for the task and returns its value or rethrows its exception.
+   * The Future is no longer valid afterwards.
+   *
+   * 等待并获取结果，任务抛出的异常将在此重新抛出
+   */
+    R get()
+    {
+        wait();
+        Future consumed(std::move(*this));
+        return consumed.result().take();
+    }
+
+    /**
+   * Attaches a continuation called with the value of this Future (nothing
+   * for Future<void>) and returns a Future for the continuation's result.
+   * The continuation runs inline on the worker that completes this task, or
+   * on the calling thread if the task already completed.  If the task threw,
+   * the continuation is skipped and the returned Future holds the exception.
+   * The Future is no longer valid afterwards.
+   *
+   * 设置后续任务：由完成本任务的worker线程直接执行，不再进入任务队列
+   */
+    template <class G>
+    Future<ThenResultOf<G, R>> then(G &&continuation);
+
+private:
+    template <class F>
+    friend class Future;
+    friend class ThreadManager;
+    template <class G, class P, class U>
+    friend struct ThenCall;
+
+    explicit Future(ThreadManager::Task *task) noexcept : task_(task) {}
+
+    void check() const
+    {
+        if (!task_)
+        {
+            throw std::future_error(std::future_errc::no_state);
+        }
+    }
+
+    FutureResult<R> &result() const { return *static_cast<FutureResult<R> *>(task_->result_); }
+
+    void reset() noexcept
+    {
+        if (task_)
+        {
+            task_->release();
+            task_ = nullptr;
+        }
+    }
+
+    ThreadManager::Task *task_;
+};
+
+/**
+ * Callable stored in the continuation task by Future<R>::then().
+ */
+template <class G, class R, class U>
+struct ThenCall
+{
+    template <class Arg>
+    ThenCall(Arg &&g, Future<R> &&parent) : function(std::forward<Arg>(g)), parent(std::move(parent)) {}
+
+    void operator()()
+    {
+        FutureResult<R> &value = parent.result();
+        if (value.exception_)
+        {
+            result.exception_ = value.exception_;
+        }
+        else
+        {
+            auto call = [this, &value]() -> U { return value.applyTo(function); };
+            result.run(call);
+        }
+        // the antecedent is not needed anymore, let it go back to the pool
+        parent.reset();
+    }
+
+    G function;
+    Future<R> parent;
+    FutureResult<U> result;
+};
+
+template <class R>
+template <class G>
+Future<ThenResultOf<G, R>> Future<R>::then(G &&continuation)
+{
+    typedef ThenResultOf<G, R> U;
+    typedef ThenCall<typename std::decay<G>::type, R, U> Call;
+
+    check();
+    ThreadManager::Task *parent = task_;
+    ThreadManager::Task *task = parent->newContinuation();
+    try
+    {
+        task->reset(TaskFunction(Call(std::forward<G>(continuation), std::move(*this))));
+    }
+    catch (...)
+    {
+        task->release();
+        throw;
+    }
+    task->makeAsync(&task->function_.template target<Call>()->result);
+    task->setState(ThreadManager::Task::EXECUTING);
+
+    Future<U> future(task);
+    parent->attach(task);
+    return future;
+}
+
+template <class F>
+Future<AsyncResultOf<F>> ThreadManager::async(F &&task, int64_t timeout, int64_t expiration)
+{
+    typedef AsyncResultOf<F> R;
+    typedef AsyncCall<typename std::decay<F>::type, R> Call;
+
+    Task *node = acquireTask();
+    try
+    {
+        node->reset(TaskFunction(Call(std::forward<F>(task))), expiration);
+    }
+    catch (...)
+    {
+        node->release();
+        throw;
+    }
+    node->makeAsync(&node->function_.template target<Call>()->result);
+
+    Future<R> future(node);
+    enqueueTask(node, timeout);
+    return future;
+}
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef _CONCURRENCY_HISTOGRAM_H_
+#define _CONCURRENCY_HISTOGRAM_H_ 1
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace concurrency {
+/**
+ * Bucketing of a log-linear (HDR style) histogram of nanosecond durations:
+ * every power of two is split into kSubBuckets linear buckets, so that a
+ * bucket is never wider than 1/kSubBuckets of its lower bound.
+ *
+ * 对数线性分桶（HDR风格）：每个2的幂区间再线性划分为kSubBuckets个桶，相对误差不超过12.5%
+ */
+struct HistogramBuckets
+{
+    static constexpr size_t kSubBucketBits = 3;
+    static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+
+    /**
+   * Values from 2^kMaxExponent on (about 37 minutes) share the last bucket.
+   */
+    static constexpr size_t kMaxExponent = 41;
+    static constexpr size_t kCount = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    static size_t indexOf(uint64_t value)
+    {
+        if (value < kSubBuckets)
+        {
+            return static_cast<size_t>(value);
+        }
+        size_t exponent = highestBit(value);
+        if (exponent >= kMaxExponent)
+        {
+            return kCount - 1;
+        }
+        size_t sub = static_cast<size_t>(value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+        return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+    }
+
+    /**
+   * Smallest value counted in bucket index.
+   */
+    static uint64_t lowerBound(size_t index)
+    {
+        if (index < kSubBuckets)
+        {
+            return index;
+        }
+        size_t exponent = index / kSubBuckets + kSubBucketBits - 1;
+        return static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << (exponent - kSubBucketBits);
+    }
+
+    /**
+   * Largest value counted in bucket index.
+   */
+    static uint64_t upperBound(size_t index)
+    {
+        return index + 1 < kCount ? lowerBound(index + 1) - 1 : UINT64_MAX;
+    }
+
+    static size_t highestBit(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return index;
+#else
+        return static_cast<size_t>(63 - __builtin_clzll(value));
+#endif
+    }
+};
+
+/**
+ * Point in time copy of one or more LatencyHistograms, in nanoseconds.
+ *
+ * 延迟直方图快照（纳秒）
+ */
+class HistogramSnapshot
+{
+public:
+    HistogramSnapshot() : buckets_(HistogramBuckets::kCount, 0), count_(0), sum_(0), max_(0) {}
+
+    uint64_t count() const { return count_; }
+
+    uint64_t max() const { return max_; }
+
+    double mean() const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+    /**
+   * \returns an upper bound of the q-quantile (0 <= q <= 1), 0 when empty
+   */
+    uint64_t percentile(double q) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(std::max(0.0, std::min(1.0, q)) * (count_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t ix = 0; ix < buckets_.size(); ix++)
+        {
+            seen += buckets_[ix];
+            if (seen >= rank)
+            {
+                return std::min(HistogramBuckets::upperBound(ix), max_);
+            }
+        }
+        return max_;
+    }
+
+    /**
+   * Count of every bucket, see HistogramBuckets for their bounds.
+   */
+    const std::vector<uint64_t> &buckets() const { return buckets_; }
+
+private:
+    friend class LatencyHistogram;
+
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+/**
+ * Histogram of durations written by a single thread and read by any.
+ * Recording is a handful of relaxed loads and stores, no read-modify-write:
+ * only the owner ever writes, readers may see a sample half recorded.
+ *
+ * 单写者多读者的延迟直方图：只有所属线程写入，无需原子读改写
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : count_(0), sum_(0), max_(0)
+    {
+        for (auto &bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    /**
+   * Records a sample, only from the owning thread.
+   */
+    void record(uint64_t nanos)
+    {
+        bump(buckets_[HistogramBuckets::indexOf(nanos)], 1);
+        bump(count_, 1);
+        bump(sum_, nanos);
+        if (nanos > max_.load(std::memory_order_relaxed))
+        {
+            max_.store(nanos, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+   * Adds the samples of other, from any thread as long as writers of this
+   * histogram are mutually excluded.
+   */
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t ix = 0; ix < HistogramBuckets::kCount; ix++)
+        {
+            bump(buckets_[ix], other.buckets_[ix].load(std::memory_order_relaxed));
+        }
+        bump(count_, other.count_.load(std::memory_order_relaxed));
+        bump(sum_, other.sum_.load(std::memory_order_relaxed));
+        if (other.max_.load(std::memory_order_relaxed) > max_.load(std::memory_order_relaxed))
+        {
+            max_.store(other.max_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    /**
+   * Adds the samples recorded so far to snapshot.
+   */
+    void addTo(HistogramSnapshot &snapshot) const
+    {
+        for (size_t ix = 0; ix < HistogramBuckets::kCount; ix++)
+        {
+            snapshot.buckets_[ix] += buckets_[ix].load(std::memory_order_relaxed);
+        }
+        snapshot.count_ += count_.load(std::memory_order_relaxed);
+        snapshot.sum_ += sum_.load(std::memory_order_relaxed);
+        snapshot.max_ = std::max(snapshot.max_, max_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static void bump(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets_[HistogramBuckets::kCount];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+}
+
+#endif
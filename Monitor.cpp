@@ -1,27 +1,33 @@
 #include "Monitor.h"
+#include "Futex.h"
 #include <assert.h>
 
-#include <condition_variable>
+#include <atomic>
 #include <chrono>
-#include <thread>
-#include <mutex>
-
-#define THRIFT_ETIMEDOUT 10060L
+#include <memory>
+#include <stdexcept>
 
 namespace concurrency {
 /**
- * Monitor implementation using the std thread library
+ * Monitor implementation on a futex word (WaitOnAddress on Windows)
+ *
+ * 基于futex的条件变量：没有等待者时notify()不做系统调用，也不再需要condition_variable_any内部的第二把锁
+ *
+ * Waiters sample sequence_ while holding the mutex, release it and block
+ * until sequence_ changes; notify() bumps sequence_ and wakes one waiter.
+ * waiters_ is only maintained so that a notify() nobody listens to costs one
+ * atomic load.  Wake-ups may be spurious, as with any condition variable.
  *
  * @version $Id:$
  */
 class Monitor::Impl {
 
 public:
-  Impl() : ownedMutex_(new Mutex()), conditionVariable_(), mutex_(nullptr) { init(ownedMutex_.get()); }
+  Impl() : ownedMutex_(new Mutex()), mutex_(nullptr), sequence_(0), waiters_(0) { init(ownedMutex_.get()); }
 
-  Impl(Mutex* mutex) : ownedMutex_(), conditionVariable_(), mutex_(nullptr) { init(mutex); }
+  Impl(Mutex* mutex) : ownedMutex_(), mutex_(nullptr), sequence_(0), waiters_(0) { init(mutex); }
 
-  Impl(Monitor* monitor) : ownedMutex_(), conditionVariable_(), mutex_(nullptr) {
+  Impl(Monitor* monitor) : ownedMutex_(), mutex_(nullptr), sequence_(0), waiters_(0) {
     init(&(monitor->mutex()));
   }
 
@@ -56,15 +62,10 @@ public:
       return waitForever();
     }
 
-    assert(mutex_);
-    auto* mutexImpl = static_cast<std::timed_mutex*>(mutex_->getUnderlyingImpl());
-    assert(mutexImpl);
-
-    std::unique_lock<std::timed_mutex> lock(*mutexImpl, std::adopt_lock);
-    bool timedout = (conditionVariable_.wait_for(lock, timeout)
-                     == std::cv_status::timeout);
-    lock.release();
-    return (timedout ? THRIFT_ETIMEDOUT : 0);
+    uint32_t sequence = beginWait();
+    bool woken = Futex::waitFor(sequence_, sequence, timeout);
+    endWait();
+    return (woken ? 0 : THRIFT_ETIMEDOUT);
   }
 
   /**
@@ -72,15 +73,10 @@ public:
    * Returns 0 if condition occurs, THRIFT_ETIMEDOUT on timeout, or an error code.
    */
   int waitForTime(const std::chrono::time_point<std::chrono::steady_clock>& abstime) {
-    assert(mutex_);
-    auto* mutexImpl = static_cast<std::timed_mutex*>(mutex_->getUnderlyingImpl());
-    assert(mutexImpl);
-
-    std::unique_lock<std::timed_mutex> lock(*mutexImpl, std::adopt_lock);
-    bool timedout = (conditionVariable_.wait_until(lock, abstime)
-                     == std::cv_status::timeout);
-    lock.release();
-    return (timedout ? THRIFT_ETIMEDOUT : 0);
+    uint32_t sequence = beginWait();
+    bool woken = Futex::waitFor(sequence_, sequence, abstime - std::chrono::steady_clock::now());
+    endWait();
+    return (woken ? 0 : THRIFT_ETIMEDOUT);
   }
 
   /**
@@ -88,26 +84,50 @@ public:
    * Returns 0 if condition occurs, or an error code otherwise.
    */
   int waitForever() {
-    assert(mutex_);
-    auto* mutexImpl = static_cast<std::timed_mutex*>(mutex_->getUnderlyingImpl());
-    assert(mutexImpl);
-
-    std::unique_lock<std::timed_mutex> lock(*mutexImpl, std::adopt_lock);
-    conditionVariable_.wait(lock);
-    lock.release();
+    uint32_t sequence = beginWait();
+    Futex::wait(sequence_, sequence);
+    endWait();
     return 0;
   }
 
-  void notify() { conditionVariable_.notify_one(); }
+  void notify() {
+    if (waiters_.load() != 0) {
+      sequence_.fetch_add(1);
+      Futex::wakeOne(sequence_);
+    }
+  }
 
-  void notifyAll() { conditionVariable_.notify_all(); }
+  void notifyAll() {
+    if (waiters_.load() != 0) {
+      sequence_.fetch_add(1);
+      Futex::wakeAll(sequence_);
+    }
+  }
 
 private:
   void init(Mutex* mutex) { mutex_ = mutex; }
 
+  /**
+   * Registers the caller as a waiter and releases the mutex, which the caller
+   * must hold.  \returns the sequence to block on
+   */
+  uint32_t beginWait() {
+    assert(mutex_);
+    waiters_.fetch_add(1);
+    uint32_t sequence = sequence_.load();
+    mutex_->unlock();
+    return sequence;
+  }
+
+  void endWait() {
+    waiters_.fetch_sub(1);
+    mutex_->lock();
+  }
+
   const std::unique_ptr<Mutex> ownedMutex_;
-  std::condition_variable_any conditionVariable_;
   Mutex* mutex_;
+  std::atomic<uint32_t> sequence_;
+  std::atomic<uint32_t> waiters_;
 };
 
 Monitor::Monitor() : impl_(new Monitor::Impl()) {
@@ -3,6 +3,11 @@
 
 #include <chrono>
 #include "Mutex.h"
+
+#ifndef THRIFT_ETIMEDOUT
+#define THRIFT_ETIMEDOUT 10060L
+#endif
+
 namespace concurrency {
 /**
  * A monitor is a combination mutex and condition-event.  Waiting and
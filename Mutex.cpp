@@ -1,16 +1,94 @@
 #include "Mutex.h"
+#include "Futex.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <mutex>
 
 namespace concurrency {
 /**
- * Implementation of Mutex class using C++11 std::timed_mutex
+ * Implementation of Mutex class on a futex word (WaitOnAddress on Windows)
  *
- * Methods throw std::system_error on error.
+ * 基于futex的互斥量：先自适应自旋，仍未获得锁才阻塞；unlock()只在有线程阻塞时才进行系统调用
+ *
+ * The word is UNLOCKED, LOCKED, or CONTENDED when a thread may be blocked on
+ * it.  A contended lock() first spins for an adaptive number of iterations,
+ * tracking how long the lock is usually held, then parks on the word.
  *
  * @version $Id:$
  */
-class Mutex::impl : public std::timed_mutex {};
+class Mutex::impl {
+public:
+  impl() : state_(UNLOCKED), spins_(0) {}
+
+  void lock() {
+    if (tryAcquire() || spin()) {
+      return;
+    }
+    uint32_t state = state_.exchange(CONTENDED, std::memory_order_acquire);
+    while (state != UNLOCKED) {
+      Futex::wait(state_, CONTENDED);
+      state = state_.exchange(CONTENDED, std::memory_order_acquire);
+    }
+  }
+
+  bool trylock() { return tryAcquire(); }
+
+  bool timedlock(int64_t ms) {
+    if (tryAcquire() || spin()) {
+      return true;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    uint32_t state = state_.exchange(CONTENDED, std::memory_order_acquire);
+    while (state != UNLOCKED) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::steady_clock::duration::zero()) {
+        // the word stays CONTENDED, at worst the owner makes one needless wake call
+        return false;
+      }
+      Futex::waitFor(state_, CONTENDED, left);
+      state = state_.exchange(CONTENDED, std::memory_order_acquire);
+    }
+    return true;
+  }
+
+  void unlock() {
+    if (state_.exchange(UNLOCKED, std::memory_order_release) == CONTENDED) {
+      Futex::wakeOne(state_);
+    }
+  }
+
+private:
+  enum : uint32_t { UNLOCKED, LOCKED, CONTENDED };
+
+  static constexpr int32_t kSpinMax = 100;
+
+  bool tryAcquire() {
+    uint32_t expected = UNLOCKED;
+    return state_.compare_exchange_strong(expected, LOCKED, std::memory_order_acquire,
+                                          std::memory_order_relaxed);
+  }
+
+  /**
+   * Spins up to twice the recent average before giving up, the average is a
+   * moving estimate of how many iterations it took to get the lock.
+   */
+  bool spin() {
+    int32_t spins = spins_.load(std::memory_order_relaxed);
+    const int32_t limit = std::min(spins * 2 + 10, kSpinMax);
+    for (int32_t count = 0; count < limit; count++) {
+      cpuRelax();
+      if (state_.load(std::memory_order_relaxed) == UNLOCKED && tryAcquire()) {
+        spins_.store(spins + (count - spins) / 8, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    spins_.store(spins + (limit - spins) / 8, std::memory_order_relaxed);
+    return false;
+  }
+
+  std::atomic<uint32_t> state_;
+  std::atomic<int32_t> spins_;
+};
 
 Mutex::Mutex() : impl_(new Mutex::impl()) {
 }
@@ -24,14 +102,14 @@ void Mutex::lock() const {
 }
 
 bool Mutex::trylock() const {
-  return impl_->try_lock();
+  return impl_->trylock();
 }
 
 bool Mutex::timedlock(int64_t ms) const {
-  return impl_->try_lock_for(std::chrono::milliseconds(ms));
+  return impl_->timedlock(ms);
 }
 
 void Mutex::unlock() const {
   impl_->unlock();
 }
-}
\ No newline at end of file
+}
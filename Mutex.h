@@ -5,7 +5,7 @@
 
 namespace concurrency {
 /**
- * 带超时时间的互斥量，底层封装了std::timed_mutex
+ * 带超时时间的互斥量，底层基于futex（Windows上为WaitOnAddress），加锁失败时先自适应自旋再阻塞
  * A simple mutex class 
  *
  * @version $Id:$
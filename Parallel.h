@@ -0,0 +1,153 @@
+#ifndef _CONCURRENCY_PARALLEL_H_
+#define _CONCURRENCY_PARALLEL_H_ 1
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "TaskGroup.h"
+
+namespace concurrency {
+namespace detail {
+/**
+ * Lazy binary splitting: a range is only split in two when a thief could
+ * take the other half right away, that is when fewer tasks are queued than
+ * there are idle workers (or none at all).  Busy pools run big chunks, an
+ * idle worker gets work within one grain.  Two lock-free counter reads.
+ */
+inline bool wantsSplit(const ThreadManager &manager)
+{
+    return manager.pendingTaskCount() < std::max(manager.idleWorkerCount(), static_cast<size_t>(1));
+}
+
+template <class Index, class F>
+struct ForRange
+{
+    ThreadManager &manager;
+    TaskGroup &group;
+    Index grain;
+    F &body;
+
+    void run(Index begin, Index end)
+    {
+        while (begin < end)
+        {
+            const Index size = static_cast<Index>(end - begin);
+            if (size > grain && wantsSplit(manager))
+            {
+                // hand the upper half out, keep going on the lower half
+                const Index middle = static_cast<Index>(begin + size / 2);
+                ForRange *self = this;
+                group.run([self, middle, end]() { self->run(middle, end); }, ThreadManager::CALLER_RUNS);
+                end = middle;
+                continue;
+            }
+            const Index stop = static_cast<Index>(begin + std::min(grain, size));
+            for (; begin < stop; ++begin)
+            {
+                body(begin);
+            }
+        }
+    }
+};
+
+template <class Index, class T, class F, class R>
+struct ReduceRange
+{
+    ThreadManager &manager;
+    Index grain;
+    const T &identity;
+    F &fold;
+    R &reduce;
+
+    T run(Index begin, Index end)
+    {
+        T value = identity;
+        while (begin < end)
+        {
+            const Index size = static_cast<Index>(end - begin);
+            if (size > grain && wantsSplit(manager))
+            {
+                // the upper half is reduced by a thief into right, or by this
+                // thread while it waits for it
+                const Index middle = static_cast<Index>(begin + size / 2);
+                T right = identity;
+                TaskGroup child(manager);
+                ReduceRange *self = this;
+                T *into = &right;
+                child.run([self, into, middle, end]() { *into = self->run(middle, end); }, ThreadManager::CALLER_RUNS);
+                value = reduce(std::move(value), run(begin, middle));
+                child.wait();
+                return reduce(std::move(value), std::move(right));
+            }
+            const Index stop = static_cast<Index>(begin + std::min(grain, size));
+            for (; begin < stop; ++begin)
+            {
+                value = fold(std::move(value), begin);
+            }
+        }
+        return value;
+    }
+};
+}
+
+/**
+ * Calls body(i) for every i in [begin, end) on the workers of manager and
+ * the calling thread, which takes part and returns once every call returned.
+ *
+ * 并行for：按需二分拆分区间（lazy binary splitting），调用线程也参与执行
+ *
+ * The range is split lazily: a chunk of grain indices is run at a time, and
+ * the remaining range is only cut in half when an idle worker could take
+ * the other half.  No task is created while the pool is busy, and a split
+ * costs one pooled task (no allocation).  Halves are queued with
+ * CALLER_RUNS whatever saturationPolicy() says: on a full queue the caller
+ * runs the half itself, so no index is ever dropped.  A queued half that
+ * is thrown away anyway (evicted by another producer's DROP_OLDEST, or by
+ * stop()) makes the call throw std::future_error, see TaskGroup.  The first
+ * exception thrown by body is rethrown once every running chunk completed.
+ * Nested calls from a worker are safe, see TaskGroup.
+ *
+ * \param grain  smallest number of indices worth a task of its own, at least 1
+ */
+template <class Index, class F>
+void parallel_for(ThreadManager &manager, Index begin, Index end, Index grain, F &&body)
+{
+    static_assert(std::is_integral<Index>::value, "parallel_for needs an integral index");
+    if (!(begin < end))
+    {
+        return;
+    }
+    TaskGroup group(manager);
+    detail::ForRange<Index, F> range{manager, group, std::max(grain, static_cast<Index>(1)), body};
+    range.run(begin, end);
+    group.wait();
+}
+
+/**
+ * Folds every i in [begin, end) into value = fold(value, i) on the workers
+ * of manager and the calling thread, then combines the partial values with
+ * reduce(left, right) in index order.
+ *
+ * 并行归约：与parallel_for相同的拆分方式，部分结果按下标顺序合并
+ *
+ * Halves are queued and lost halves reported as for parallel_for().  Every
+ * chunk starts from identity, so identity must be neutral for reduce.
+ * reduce must be associative but need not be commutative.
+ *
+ * \param grain  smallest number of indices worth a task of its own, at least 1
+ */
+template <class Index, class T, class F, class R>
+T parallel_reduce(ThreadManager &manager, Index begin, Index end, Index grain, T identity, F &&fold, R &&reduce)
+{
+    static_assert(std::is_integral<Index>::value, "parallel_reduce needs an integral index");
+    if (!(begin < end))
+    {
+        return identity;
+    }
+    detail::ReduceRange<Index, T, F, R> range{manager, std::max(grain, static_cast<Index>(1)), identity, fold, reduce};
+    return range.run(begin, end);
+}
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef _CONCURRENCY_TASKFUNCTION_H_
+#define _CONCURRENCY_TASKFUNCTION_H_ 1
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "Thread.h"
+
+namespace concurrency {
+/**
+ * Callable that runs a shared_ptr<Runnable>, used by ThreadManager::add()
+ * to store a Runnable in a TaskFunction.
+ */
+struct RunnableCall
+{
+    explicit RunnableCall(std::shared_ptr<Runnable> value) : runnable(std::move(value)) {}
+
+    void operator()() { runnable->run(); }
+
+    std::shared_ptr<Runnable> runnable;
+};
+
+/**
+ * Move-only, type-erased void() callable.
+ *
+ * 仅可移动的类型擦除可调用对象：不超过kInlineSize字节的闭包直接存放在对象内部（小对象优化），
+ * 不做任何堆分配和引用计数；更大的闭包才在堆上分配
+ *
+ * Closures of up to kInlineSize bytes that are nothrow move constructible are
+ * stored inline; larger ones are heap allocated once and moved by pointer.
+ */
+class TaskFunction
+{
+public:
+    /**
+   * 40 bytes (five pointers) keep the whole object at 48, so that a pooled
+   * task has room for its state word on the callable's cache line.
+   */
+    static constexpr size_t kInlineSize = 40;
+
+    TaskFunction() noexcept : ops_(nullptr) {}
+
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskFunction(F &&f) : ops_(nullptr)
+    {
+        typedef typename std::decay<F>::type Callable;
+        construct<Callable>(std::forward<F>(f), IsInline<Callable>());
+    }
+
+    TaskFunction(TaskFunction &&other) noexcept : ops_(other.ops_)
+    {
+        if (ops_)
+        {
+            ops_->relocate(other.storage_, storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    TaskFunction &operator=(TaskFunction &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_)
+            {
+                other.ops_->relocate(other.storage_, storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction &) = delete;
+    TaskFunction &operator=(const TaskFunction &) = delete;
+
+    ~TaskFunction() { reset(); }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    /**
+   * Destroys the stored callable.
+   */
+    void reset() noexcept
+    {
+        if (ops_)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    /**
+   * \returns the Runnable stored through RunnableCall, or an empty pointer
+   * for any other callable
+   */
+    std::shared_ptr<Runnable> runnable() const
+    {
+        return ops_ ? ops_->runnable(storage_) : std::shared_ptr<Runnable>();
+    }
+
+    /**
+   * Converts the callable into a Runnable and leaves this object empty.
+   * Callables other than RunnableCall are moved into a heap allocated wrapper.
+   *
+   * 转换为Runnable（用于过期回调和removeNextPending()），非Runnable的闭包会在堆上包装一次
+   */
+    std::shared_ptr<Runnable> toRunnable();
+
+    /**
+   * \returns the stored callable if it is an F, nullptr otherwise.  The
+   * address stays valid until this object is moved from or reset.
+   */
+    template <class F>
+    F *target() noexcept
+    {
+        if (ops_ == &InlineOps<F>::ops)
+        {
+            return std::launder(reinterpret_cast<F *>(storage_));
+        }
+        if (ops_ == &HeapOps<F>::ops)
+        {
+            return HeapOps<F>::get(storage_);
+        }
+        return nullptr;
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void *storage);
+        void (*relocate)(void *from, void *to);
+        void (*destroy)(void *storage);
+        std::shared_ptr<Runnable> (*runnable)(const void *storage);
+    };
+
+    template <class F>
+    using IsInline = std::integral_constant<bool, sizeof(F) <= kInlineSize &&
+                                                      alignof(F) <= alignof(std::max_align_t) &&
+                                                      std::is_nothrow_move_constructible<F>::value>;
+
+    template <class F>
+    static std::shared_ptr<Runnable> peek(const F &) { return std::shared_ptr<Runnable>(); }
+
+    static std::shared_ptr<Runnable> peek(const RunnableCall &call) { return call.runnable; }
+
+    template <class F>
+    struct InlineOps
+    {
+        static void invoke(void *storage) { (*static_cast<F *>(storage))(); }
+
+        static void relocate(void *from, void *to)
+        {
+            F *source = static_cast<F *>(from);
+            ::new (to) F(std::move(*source));
+            source->~F();
+        }
+
+        static void destroy(void *storage) { static_cast<F *>(storage)->~F(); }
+
+        static std::shared_ptr<Runnable> runnable(const void *storage) { return peek(*static_cast<const F *>(storage)); }
+
+        static const Ops ops;
+    };
+
+    template <class F>
+    struct HeapOps
+    {
+        static F *get(void *storage) { return *static_cast<F **>(storage); }
+
+        static void invoke(void *storage) { (*get(storage))(); }
+
+        static void relocate(void *from, void *to) { ::new (to) F *(get(from)); }
+
+        static void destroy(void *storage) { delete get(storage); }
+
+        static std::shared_ptr<Runnable> runnable(const void *storage) { return peek(**static_cast<F *const *>(storage)); }
+
+        static const Ops ops;
+    };
+
+    template <class F, class Arg>
+    void construct(Arg &&f, std::true_type)
+    {
+        ::new (static_cast<void *>(storage_)) F(std::forward<Arg>(f));
+        ops_ = &InlineOps<F>::ops;
+    }
+
+    template <class F, class Arg>
+    void construct(Arg &&f, std::false_type)
+    {
+        ::new (static_cast<void *>(storage_)) F *(new F(std::forward<Arg>(f)));
+        ops_ = &HeapOps<F>::ops;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops *ops_;
+};
+
+template <class F>
+const TaskFunction::Ops TaskFunction::InlineOps<F>::ops = {&invoke, &relocate, &destroy, &runnable};
+
+template <class F>
+const TaskFunction::Ops TaskFunction::HeapOps<F>::ops = {&invoke, &relocate, &destroy, &runnable};
+
+/**
+ * Runnable that owns a TaskFunction, returned by TaskFunction::toRunnable().
+ */
+class FunctionRunnable : public Runnable
+{
+public:
+    explicit FunctionRunnable(TaskFunction function) : function_(std::move(function)) {}
+
+    void run() override
+    {
+        if (function_)
+        {
+            function_();
+        }
+    }
+
+private:
+    TaskFunction function_;
+};
+
+inline std::shared_ptr<Runnable> TaskFunction::toRunnable()
+{
+    std::shared_ptr<Runnable> result = runnable();
+    if (!result && ops_)
+    {
+        result = std::make_shared<FunctionRunnable>(std::move(*this));
+    }
+    reset();
+    return result;
+}
+}
+
+#endif
@@ -0,0 +1,87 @@
+#include "TaskGroup.h"
+#include "Futex.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace concurrency {
+namespace {
+/**
+ * Counts a helping wait() for as long as it runs a task
+ */
+struct HelpScope {
+  explicit HelpScope(unsigned &depth) : depth(depth) { ++depth; }
+  ~HelpScope() { --depth; }
+
+  unsigned &depth;
+};
+}
+
+thread_local unsigned TaskGroup::helpDepth_ = 0;
+
+TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  } catch (const std::exception &e) {
+    printf("[ERROR] TaskGroup::~TaskGroup a task raised an exception: %s", e.what());
+  } catch (...) {
+    printf("[ERROR] TaskGroup::~TaskGroup a task raised an unknown exception");
+  }
+}
+
+void TaskGroup::wait() {
+  const bool worker = manager_.onWorkerThread();
+  const bool help = worker && helpDepth_ < kMaxHelpDepth;
+  bool announced = false;
+  uint32_t count = pending_.load(std::memory_order_acquire);
+  while ((count & ~kWaiting) != 0) {
+    // a worker runs the tasks it would otherwise wait for
+    if (help) {
+      HelpScope scope(helpDepth_);
+      if (manager_.runPendingTask()) {
+        count = pending_.load(std::memory_order_acquire);
+        continue;
+      }
+    }
+
+    // announce the waiter so that finish() knows it has to wake somebody up
+    if (!(count & kWaiting) &&
+        !pending_.compare_exchange_weak(count, count | kWaiting, std::memory_order_acquire)) {
+      continue;
+    }
+    announced = true;
+    if (worker) {
+      // the rest of the group runs elsewhere, look for new tasks now and then
+      Futex::waitFor(pending_, count | kWaiting, std::chrono::microseconds(kHelpIntervalMicros));
+    } else {
+      Futex::wait(pending_, count | kWaiting);
+    }
+    count = pending_.load(std::memory_order_acquire);
+  }
+  if (announced) {
+    pending_.fetch_and(~kWaiting, std::memory_order_relaxed);
+  }
+
+  if (failed_.load(std::memory_order_acquire)) {
+    std::exception_ptr error = std::move(error_);
+    error_ = nullptr;
+    failed_.store(false, std::memory_order_relaxed);
+    std::rethrow_exception(error);
+  }
+}
+
+void TaskGroup::finish() {
+  // nothing of the group may be touched afterwards: wait() can return and
+  // destroy it as soon as the count drops to 0, the wake-up only names the address
+  if (pending_.fetch_sub(1, std::memory_order_acq_rel) == (kWaiting | 1)) {
+    Futex::wakeAll(pending_);
+  }
+}
+
+void TaskGroup::fail(std::exception_ptr error) {
+  bool expected = false;
+  if (failed_.compare_exchange_strong(expected, true, std::memory_order_relaxed)) {
+    error_ = std::move(error);
+  }
+}
+}
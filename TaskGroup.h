@@ -0,0 +1,186 @@
+#ifndef _CONCURRENCY_TASKGROUP_H_
+#define _CONCURRENCY_TASKGROUP_H_ 1
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <type_traits>
+#include <utility>
+#include "ThreadManager.h"
+
+namespace concurrency {
+/**
+ * Group of tasks run on a ThreadManager and waited for together (fork-join).
+ *
+ * 任务组：批量提交子任务并等待全部完成；工作线程在wait()中执行其他任务而不是阻塞
+ *
+ * wait() called on a worker thread of the manager does not park: it runs
+ * pending tasks on the calling thread, from the worker's local queue first
+ * (where the tasks it spawned land in work-stealing mode), then the shared
+ * queue and its peers, until the group is done.  Nested groups are
+ * therefore safe, a worker waiting on its children keeps executing them.
+ * Any other thread simply blocks.
+ *
+ * A task run while helping may wait on a group of its own and help in turn,
+ * so helping nests on the worker's stack.  Past kMaxHelpDepth levels a
+ * worker stops helping and its groups run their tasks inline: the pool is
+ * saturated by then, and the stack stays bounded.
+ *
+ * A task that is not run (expired, removed, refused by the saturation
+ * policy or dropped by stop()) counts as done once its callable is
+ * destroyed, and fails the group: wait() throws std::future_error with
+ * std::future_errc::broken_promise unless a task threw first.  The group
+ * must not outlive its thread manager and must not be destroyed before
+ * wait() returned; the destructor waits.
+ */
+class TaskGroup
+{
+public:
+    explicit TaskGroup(ThreadManager &manager) : manager_(manager), pending_(0), failed_(false) {}
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    ~TaskGroup();
+
+    /**
+   * Adds a callable to the group, see ThreadManager::submit().  On a worker
+   * thread a full queue runs the task inline (CALLER_RUNS), elsewhere the
+   * manager's saturationPolicy() applies.
+   */
+    template <class F>
+    void run(F &&task);
+
+    /**
+   * run() with its own saturation policy instead of saturationPolicy(); on
+   * a worker thread BLOCK runs the task inline like CALLER_RUNS.
+   */
+    template <class F>
+    void run(F &&task, ThreadManager::SATURATION policy);
+
+    /**
+   * Waits until every task of the group is done, helping on a worker thread.
+   * Rethrows the first exception thrown by a task of the group, or a
+   * broken_promise std::future_error for a task that was never run; the
+   * group can be reused afterwards.
+   */
+    void wait();
+
+    /**
+   * \returns true if no task of the group is left, never blocks
+   */
+    bool isDone() const { return (pending_.load(std::memory_order_acquire) & ~kWaiting) == 0; }
+
+private:
+    /**
+   * Callable stored in the task: runs the user's callable and counts it done.
+   */
+    template <class F>
+    struct GroupCall
+    {
+        template <class Arg>
+        GroupCall(TaskGroup *group, Arg &&f) : group(group), function(std::forward<Arg>(f)) {}
+
+        GroupCall(GroupCall &&other) noexcept(std::is_nothrow_move_constructible<F>::value)
+            : group(other.group), function(std::move(other.function))
+        {
+            other.group = nullptr;
+        }
+
+        ~GroupCall()
+        {
+            if (group)
+            {
+                // never run, the work it stood for is lost
+                group->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                group->finish();
+            }
+        }
+
+        void operator()()
+        {
+            try
+            {
+                function();
+            }
+            catch (...)
+            {
+                group->fail(std::current_exception());
+            }
+            TaskGroup *done = group;
+            group = nullptr;
+            done->finish();
+        }
+
+        TaskGroup *group;
+        F function;
+    };
+
+    /**
+   * Set in pending_ by a thread blocked in wait()
+   */
+    static constexpr uint32_t kWaiting = 1u << 31;
+
+    /**
+   * How long a worker that found nothing to run waits before looking again
+   */
+    static constexpr int64_t kHelpIntervalMicros = 200;
+
+public:
+    /**
+   * Deepest nesting of wait() calls that help on one worker thread
+   */
+    static constexpr unsigned kMaxHelpDepth = 64;
+
+private:
+    /**
+   * wait() calls helping on the calling thread
+   */
+    static thread_local unsigned helpDepth_;
+
+    void finish();
+
+    void fail(std::exception_ptr error);
+
+    ThreadManager &manager_;
+
+    /**
+   * 未完成的任务数（低31位）与等待标志
+   */
+    std::atomic<uint32_t> pending_;
+    std::atomic<bool> failed_;
+    std::exception_ptr error_;
+};
+
+template <class F>
+void TaskGroup::run(F &&task)
+{
+    // a worker can not block on a full queue, it runs the task itself
+    run(std::forward<F>(task), manager_.onWorkerThread() ? ThreadManager::CALLER_RUNS : manager_.saturationPolicy());
+}
+
+template <class F>
+void TaskGroup::run(F &&task, ThreadManager::SATURATION policy)
+{
+    GroupCall<typename std::decay<F>::type> call(this, std::forward<F>(task));
+    // from here on call, or the one it is moved into, counts the task done
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    if (manager_.onWorkerThread())
+    {
+        if (helpDepth_ >= kMaxHelpDepth)
+        {
+            // no helping this deep: a queued task would only be waited for
+            call();
+            return;
+        }
+        if (policy == ThreadManager::BLOCK)
+        {
+            policy = ThreadManager::CALLER_RUNS;
+        }
+    }
+    manager_.submit(std::move(call), policy);
+}
+}
+
+#endif
@@ -0,0 +1,774 @@
+#ifndef _CONCURRENCY_TASKQUEUE_H_
+#define _CONCURRENCY_TASKQUEUE_H_ 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace concurrency {
+/**
+ * 缓存行大小，用于隔离被不同线程频繁写入的数据，避免伪共享
+ */
+constexpr size_t kCacheLineSize = 64;
+
+/**
+ * Pending task queue interface used by ThreadManager.
+ *
+ * 任务队列接口：ThreadManager的挂起任务队列可以替换为不同的实现
+ *
+ * Implementations that report isLockFree() may have push() and pop() called
+ * concurrently from any number of threads; the others rely on the caller
+ * holding a lock.  removeIf() always requires external exclusion against other
+ * removeIf() calls.
+ */
+template <class T>
+class TaskQueue
+{
+public:
+    typedef std::function<bool(const T &)> Predicate;
+
+    virtual ~TaskQueue() = default;
+
+    /**
+   * Appends a value to the back of the queue.  value is only moved from on
+   * success.
+   * \returns false if the queue is bounded and full
+   */
+    virtual bool push(T &&value) = 0;
+
+    /**
+   * Removes the value at the front of the queue.
+   * \returns false if the queue is empty
+   */
+    virtual bool pop(T &value) = 0;
+
+    /**
+   * Removes the value to give up first when a full queue must make room for
+   * a new one, by default the front of the queue.
+   * \returns false if the queue is empty
+   */
+    virtual bool evict(T &value) { return pop(value); }
+
+    /**
+   * Number of queued values; only a snapshot for lock-free queues.
+   */
+    virtual size_t size() const = 0;
+
+    bool empty() const { return size() == 0; }
+
+    /**
+   * Maximum number of values the queue can hold, 0 means unbounded.
+   */
+    virtual size_t capacity() const = 0;
+
+    virtual bool isLockFree() const = 0;
+
+    /**
+   * Moves the values matching pred into removed, keeping the order of the
+   * remaining values.
+   *
+   * \param[in]  justOne  if true, stop after the first match
+   * \returns the number of values removed
+   */
+    virtual size_t removeIf(const Predicate &pred, bool justOne, std::vector<T> &removed) = 0;
+};
+
+/**
+ * Unbounded queue on top of std::deque.  Not synchronized: every call must be
+ * made under the owner's lock.
+ *
+ * 基于std::deque的无界队列，需由调用者加锁
+ */
+template <class T>
+class DequeTaskQueue : public TaskQueue<T>
+{
+public:
+    bool push(T &&value) override
+    {
+        queue_.push_back(std::move(value));
+        return true;
+    }
+
+    bool pop(T &value) override
+    {
+        if (queue_.empty())
+        {
+            return false;
+        }
+        value = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+    }
+
+    size_t size() const override { return queue_.size(); }
+
+    size_t capacity() const override { return 0; }
+
+    bool isLockFree() const override { return false; }
+
+    size_t removeIf(const typename TaskQueue<T>::Predicate &pred, bool justOne, std::vector<T> &removed) override
+    {
+        size_t count = 0;
+        for (auto it = queue_.begin(); it != queue_.end();)
+        {
+            if (pred(*it))
+            {
+                removed.push_back(std::move(*it));
+                it = queue_.erase(it);
+                ++count;
+                if (justOne)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return count;
+    }
+
+private:
+    std::deque<T> queue_;
+};
+
+/**
+ * \returns the index of the lowest set bit of a non-zero value
+ */
+inline size_t lowestBit(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctz(value));
+#endif
+}
+
+/**
+ * \returns the index of the highest set bit of a non-zero value
+ */
+inline size_t highestBit(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return index;
+#else
+    return static_cast<size_t>(31 - __builtin_clz(value));
+#endif
+}
+
+/**
+ * Unbounded queue with a FIFO lane per priority level, lane 0 being the most
+ * urgent.  A bitmap of the non-empty lanes makes finding the next value O(1).
+ * Not synchronized: every call must be made under the owner's lock.
+ *
+ * 多优先级队列：每个优先级一个FIFO通道，用位图记录非空通道，需由调用者加锁
+ *
+ * Priority is a functor returning the lane of a value, values beyond the
+ * last lane go to the last one.  With a non-zero aging interval a value
+ * gains one level for every interval it has waited, so the fronts of the
+ * non-empty lanes are compared on pop() and lower lanes can not starve.
+ */
+template <class T, class Priority>
+class PriorityTaskQueue : public TaskQueue<T>
+{
+public:
+    static constexpr size_t kMaxLanes = 32;
+
+    explicit PriorityTaskQueue(size_t lanes,
+                               std::chrono::milliseconds aging = std::chrono::milliseconds(0),
+                               Priority priority = Priority())
+        : lanes_(std::max(static_cast<size_t>(1), std::min(lanes, kMaxLanes))),
+          aging_(aging),
+          priority_(priority),
+          bitmap_(0),
+          size_(0) {}
+
+    bool push(T &&value) override
+    {
+        size_t lane = std::min(static_cast<size_t>(priority_(value)), lanes_.size() - 1);
+        lanes_[lane].push_back(Entry{std::move(value), aging_.count() > 0 ? Clock::now() : Clock::time_point()});
+        bitmap_ |= 1u << lane;
+        ++size_;
+        return true;
+    }
+
+    bool pop(T &value) override
+    {
+        if (bitmap_ == 0)
+        {
+            return false;
+        }
+        size_t lane = nextLane();
+        std::deque<Entry> &queue = lanes_[lane];
+        value = std::move(queue.front().value);
+        queue.pop_front();
+        if (queue.empty())
+        {
+            bitmap_ &= ~(1u << lane);
+        }
+        --size_;
+        return true;
+    }
+
+    /**
+   * Gives up the oldest value of the least urgent non-empty lane.
+   */
+    bool evict(T &value) override
+    {
+        if (bitmap_ == 0)
+        {
+            return false;
+        }
+        size_t lane = highestBit(bitmap_);
+        std::deque<Entry> &queue = lanes_[lane];
+        value = std::move(queue.front().value);
+        queue.pop_front();
+        if (queue.empty())
+        {
+            bitmap_ &= ~(1u << lane);
+        }
+        --size_;
+        return true;
+    }
+
+    size_t size() const override { return size_; }
+
+    /**
+   * Number of values queued in one lane.
+   */
+    size_t size(size_t lane) const { return lane < lanes_.size() ? lanes_[lane].size() : 0; }
+
+    size_t lanes() const { return lanes_.size(); }
+
+    size_t capacity() const override { return 0; }
+
+    bool isLockFree() const override { return false; }
+
+    /**
+   * Scans the lanes from the most urgent one.
+   */
+    size_t removeIf(const typename TaskQueue<T>::Predicate &pred, bool justOne, std::vector<T> &removed) override
+    {
+        size_t count = 0;
+        for (size_t lane = 0; lane < lanes_.size() && !(justOne && count > 0); lane++)
+        {
+            std::deque<Entry> &queue = lanes_[lane];
+            for (auto it = queue.begin(); it != queue.end() && !(justOne && count > 0);)
+            {
+                if (pred(it->value))
+                {
+                    removed.push_back(std::move(it->value));
+                    it = queue.erase(it);
+                    ++count;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            if (queue.empty())
+            {
+                bitmap_ &= ~(1u << lane);
+            }
+        }
+        size_ -= count;
+        return count;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        T value;
+        Clock::time_point enqueued;
+    };
+
+    /**
+   * The most urgent non-empty lane, or with aging the lane whose front has
+   * the best effective level: lane - waited / aging_.
+   */
+    size_t nextLane() const
+    {
+        size_t best = lowestBit(bitmap_);
+        uint32_t rest = bitmap_ & ~((2u << best) - 1);
+        if (aging_.count() <= 0 || rest == 0)
+        {
+            return best;
+        }
+
+        const Clock::time_point now = Clock::now();
+        auto score = [this, &now](size_t lane) {
+            return aging_ * static_cast<int64_t>(lane) - (now - lanes_[lane].front().enqueued);
+        };
+        auto bestScore = score(best);
+        for (; rest != 0; rest &= rest - 1)
+        {
+            size_t lane = lowestBit(rest);
+            auto laneScore = score(lane);
+            if (laneScore < bestScore)
+            {
+                best = lane;
+                bestScore = laneScore;
+            }
+        }
+        return best;
+    }
+
+    std::vector<std::deque<Entry>> lanes_;
+    const std::chrono::milliseconds aging_;
+    Priority priority_;
+    uint32_t bitmap_;
+    size_t size_;
+};
+
+/**
+ * Unbounded queue with a FIFO lane per key (a tenant), served by weighted
+ * deficit round-robin: every time a lane's turn comes it may hand out
+ * quantum * weight values before the next active lane is served.  Not
+ * synchronized: every call must be made under the owner's lock.
+ *
+ * 公平队列：每个租户（键）一个FIFO通道，按加权差额轮询（DRR）出队，需由调用者加锁
+ *
+ * Key is a functor returning the key of a value.  Only the lanes holding
+ * values are linked in the ring, so push() and pop() are O(1) whatever the
+ * number of idle keys; the lane of a key that was never configured with
+ * share() is dropped once it runs empty.  The cost of a value is not known
+ * before it runs, every value counts as one.  A lane's capacity is not
+ * enforced by push(), which never fails: the owner checks full() before
+ * admitting a value.
+ */
+template <class T, class Key>
+class FairTaskQueue : public TaskQueue<T>
+{
+public:
+    explicit FairTaskQueue(size_t quantum = 1, Key key = Key())
+        : quantum_(std::max(quantum, static_cast<size_t>(1))), key_(key), current_(nullptr), size_(0) {}
+
+    FairTaskQueue(const FairTaskQueue &) = delete;
+    FairTaskQueue &operator=(const FairTaskQueue &) = delete;
+
+    /**
+   * Sets the weight (at least 1) and the capacity (0 unbounded) of the lane
+   * of key; the lane is kept from then on.  A new weight applies from the
+   * lane's next turn.
+   */
+    void share(uint32_t key, uint32_t weight, size_t capacity)
+    {
+        Lane &lane = laneOf(key);
+        lane.weight = std::max(weight, 1u);
+        lane.capacity = capacity;
+        lane.configured = true;
+    }
+
+    /**
+   * \returns true if the lane of value holds its capacity or more values
+   */
+    bool full(const T &value) const
+    {
+        auto it = lanes_.find(key_(value));
+        return it != lanes_.end() && it->second.capacity != 0 && it->second.queue.size() >= it->second.capacity;
+    }
+
+    bool push(T &&value) override
+    {
+        Lane &lane = laneOf(key_(value));
+        lane.queue.push_back(std::move(value));
+        ++size_;
+        if (!lane.next)
+        {
+            activate(lane);
+        }
+        return true;
+    }
+
+    bool pop(T &value) override
+    {
+        if (!current_)
+        {
+            return false;
+        }
+        Lane &lane = *current_;
+        value = std::move(lane.queue.front());
+        lane.queue.pop_front();
+        --size_;
+        if (lane.queue.empty())
+        {
+            deactivate(lane);
+        }
+        else if (--lane.deficit == 0)
+        {
+            current_ = lane.next;
+            grant(*current_);
+        }
+        return true;
+    }
+
+    /**
+   * Gives up the oldest value of the longest lane, the key flooding the
+   * queue pays for it.  Scans the active lanes only.
+   */
+    bool evict(T &value) override
+    {
+        if (!current_)
+        {
+            return false;
+        }
+        Lane *longest = current_;
+        for (Lane *lane = current_->next; lane != current_; lane = lane->next)
+        {
+            if (lane->queue.size() > longest->queue.size())
+            {
+                longest = lane;
+            }
+        }
+        takeFront(*longest, value);
+        return true;
+    }
+
+    /**
+   * Gives up the oldest value of the lane of key.
+   * \returns false if that lane is empty
+   */
+    bool evict(uint32_t key, T &value)
+    {
+        auto it = lanes_.find(key);
+        if (it == lanes_.end() || it->second.queue.empty())
+        {
+            return false;
+        }
+        takeFront(it->second, value);
+        return true;
+    }
+
+    size_t size() const override { return size_; }
+
+    /**
+   * Number of values queued for one key.
+   */
+    size_t size(uint32_t key) const
+    {
+        auto it = lanes_.find(key);
+        return it != lanes_.end() ? it->second.queue.size() : 0;
+    }
+
+    size_t capacity() const override { return 0; }
+
+    bool isLockFree() const override { return false; }
+
+    /**
+   * Scans the active lanes in dispatch order.
+   */
+    size_t removeIf(const typename TaskQueue<T>::Predicate &pred, bool justOne, std::vector<T> &removed) override
+    {
+        std::vector<Lane *> active;
+        if (current_)
+        {
+            Lane *lane = current_;
+            do
+            {
+                active.push_back(lane);
+                lane = lane->next;
+            } while (lane != current_);
+        }
+
+        size_t count = 0;
+        for (size_t ix = 0; ix < active.size() && !(justOne && count > 0); ix++)
+        {
+            std::deque<T> &queue = active[ix]->queue;
+            for (auto it = queue.begin(); it != queue.end() && !(justOne && count > 0);)
+            {
+                if (pred(*it))
+                {
+                    removed.push_back(std::move(*it));
+                    it = queue.erase(it);
+                    ++count;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            if (queue.empty())
+            {
+                deactivate(*active[ix]);
+            }
+        }
+        size_ -= count;
+        return count;
+    }
+
+private:
+    struct Lane
+    {
+        explicit Lane(uint32_t key)
+            : key(key), prev(nullptr), next(nullptr), deficit(0), weight(1), capacity(0), configured(false) {}
+
+        const uint32_t key;
+        std::deque<T> queue;
+
+        /**
+       * 活跃通道环形链表，空闲通道为nullptr
+       */
+        Lane *prev;
+        Lane *next;
+
+        /**
+       * Values the lane may still hand out in its current turn
+       */
+        size_t deficit;
+        uint32_t weight;
+        size_t capacity;
+        bool configured;
+    };
+
+    Lane &laneOf(uint32_t key)
+    {
+        // node based: a lane never moves while the map grows
+        return lanes_.emplace(key, Lane(key)).first->second;
+    }
+
+    void grant(Lane &lane) { lane.deficit = quantum_ * lane.weight; }
+
+    /**
+   * Links a lane that just got a value, at the end of the current round.
+   */
+    void activate(Lane &lane)
+    {
+        if (!current_)
+        {
+            lane.prev = lane.next = &lane;
+            current_ = &lane;
+            grant(lane);
+            return;
+        }
+        lane.next = current_;
+        lane.prev = current_->prev;
+        current_->prev->next = &lane;
+        current_->prev = &lane;
+        lane.deficit = 0;
+    }
+
+    /**
+   * Unlinks a lane that ran empty, its turn passes to the next one.
+   */
+    void deactivate(Lane &lane)
+    {
+        Lane *next = lane.next != &lane ? lane.next : nullptr;
+        lane.prev->next = lane.next;
+        lane.next->prev = lane.prev;
+        lane.prev = lane.next = nullptr;
+        lane.deficit = 0;
+        if (current_ == &lane)
+        {
+            current_ = next;
+            if (current_)
+            {
+                grant(*current_);
+            }
+        }
+        if (!lane.configured)
+        {
+            lanes_.erase(lane.key);
+        }
+    }
+
+    void takeFront(Lane &lane, T &value)
+    {
+        value = std::move(lane.queue.front());
+        lane.queue.pop_front();
+        --size_;
+        if (lane.queue.empty())
+        {
+            deactivate(lane);
+        }
+    }
+
+    std::unordered_map<uint32_t, Lane> lanes_;
+    const size_t quantum_;
+    Key key_;
+
+    /**
+   * The lane being served, nullptr when the queue is empty
+   */
+    Lane *current_;
+    size_t size_;
+};
+
+/**
+ * Bounded multi-producer multi-consumer ring buffer (Dmitry Vyukov's
+ * sequence-number design).  push() and pop() are lock-free and never
+ * allocate; the producer and consumer positions live on separate cache lines.
+ *
+ * 无锁的有界多生产者多消费者环形队列，容量向上取整为2的幂
+ */
+template <class T>
+class RingTaskQueue : public TaskQueue<T>
+{
+public:
+    explicit RingTaskQueue(size_t capacity)
+        : mask_(roundUp(capacity) - 1),
+          cells_(new Cell[mask_ + 1]),
+          enqueuePos_(0),
+          dequeuePos_(0)
+    {
+        for (size_t ix = 0; ix <= mask_; ix++)
+        {
+            cells_[ix].sequence.store(ix, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+   * May also fail while a consumer is still releasing the cell of the
+   * previous lap, callers that reserved room up front simply retry.
+   */
+    bool push(T &&value) override
+    {
+        Cell *cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the cell still holds a value from the previous lap: full
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value) override
+    {
+        Cell *cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the cell has not been written in this lap: empty
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->value = T();
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const override
+    {
+        size_t dequeued = dequeuePos_.load(std::memory_order_acquire);
+        size_t enqueued = enqueuePos_.load(std::memory_order_acquire);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() const override { return mask_ + 1; }
+
+    bool isLockFree() const override { return true; }
+
+    /**
+   * Rotates the ring once: every value is popped and either removed or pushed
+   * back.  Values pushed concurrently by other producers may end up ahead of
+   * the rotated ones.
+   */
+    size_t removeIf(const typename TaskQueue<T>::Predicate &pred, bool justOne, std::vector<T> &removed) override
+    {
+        size_t count = 0;
+        size_t rotate = size();
+        for (size_t ix = 0; ix < rotate; ix++)
+        {
+            T value;
+            if (!pop(value))
+            {
+                break;
+            }
+            if ((!justOne || count == 0) && pred(value))
+            {
+                removed.push_back(std::move(value));
+                ++count;
+            }
+            else
+            {
+                while (!push(std::move(value)))
+                {
+                    // full until a concurrent pop releases its cell, or producers
+                    // are not admission controlled
+                    std::this_thread::yield();
+                }
+            }
+        }
+        return count;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUp(size_t value)
+    {
+        size_t result = 2;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t mask_;
+    const std::unique_ptr<Cell[]> cells_;
+    alignas(kCacheLineSize) std::atomic<size_t> enqueuePos_;
+    alignas(kCacheLineSize) std::atomic<size_t> dequeuePos_;
+    char padding_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+};
+}
+
+#endif
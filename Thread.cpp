@@ -1,7 +1,13 @@
 #include "Thread.h"
 
+#include <cstdio>
+#include "CpuTopology.h"
+
 namespace concurrency {
 void Thread::threadMain(std::shared_ptr<Thread> thread) {
+  if (!thread->cpus_.empty() && !CpuTopology::bindCurrentThread(thread->cpus_)) {
+    printf("[ERROR] Thread::threadMain failed to set the CPU affinity");
+  }
   thread->setState(started);
   thread->runnable()->run();
 
@@ -1,5 +1,9 @@
+#ifndef _CONCURRENCY_THREAD_H_
+#define _CONCURRENCY_THREAD_H_ 1
+
 #include <memory>
 #include <thread>
+#include <vector>
 #include "Monitor.h"
 
 namespace concurrency {
@@ -58,7 +62,7 @@ public:
   static inline id_t get_current() { return std::this_thread::get_id(); }
 
   Thread(bool detached, std::shared_ptr<Runnable> runnable)
-    : state_(uninitialized), detached_(detached) {
+    : state_(uninitialized), detached_(detached), numaNode_(-1) {
     this->_runnable = runnable;
   }
 
@@ -94,8 +98,15 @@ public:
    * Starts the thread. Does platform specific thread creation and
    * configuration then invokes the run method of the Runnable object bound
    * to this thread.
+   *
+   * With waitForStart false the call returns as soon as the thread is
+   * created, without the round trip to the new thread: the thread keeps
+   * itself and its runnable alive, so callers starting many threads can
+   * wait for all of them once instead (see ThreadManager::addWorker()).
+   *
+   * 启动线程；waitForStart为false时不等待新线程开始运行
    */
-  void start() {
+  void start(bool waitForStart = true) {
     if (getState() != uninitialized) {
       return;
     }
@@ -110,7 +121,11 @@ public:
 
     if (detached_)
       thread_->detach();
-    
+
+    if (!waitForStart) {
+      return;
+    }
+
     // Wait for the thread to start and get far enough to grab everything
     // that it needs from the calling context, thus absolving the caller
     // from being required to hold on to runnable indefinitely.
@@ -138,6 +153,25 @@ public:
    */
   std::shared_ptr<Runnable> runnable() const { return _runnable; }
 
+  /**
+   * Sets the CPUs the thread binds itself to when it starts, empty for no
+   * binding, and the NUMA node they belong to (-1 if they span several).
+   * Only meant to be called before start(), see ThreadFactory::setAffinity().
+   *
+   * 设置线程启动时绑定的CPU集合及其所属的NUMA节点
+   */
+  void setAffinity(const std::vector<int> &cpus, int numaNode) {
+    cpus_ = cpus;
+    numaNode_ = numaNode;
+  }
+
+  const std::vector<int> &affinity() const { return cpus_; }
+
+  /**
+   * \return the NUMA node the thread is bound to, -1 if none
+   */
+  int numaNode() const { return numaNode_; }
+
 private:
   std::shared_ptr<Runnable> _runnable;
   std::unique_ptr<std::thread> thread_;
@@ -145,5 +179,10 @@ private:
   STATE state_;
   // 是否在线程运行后分离线程，分离后则当前std::thread变量与运行的线程无关
   bool detached_;
+  // 线程绑定的CPU集合，为空则不绑定
+  std::vector<int> cpus_;
+  int numaNode_;
 };
-}
\ No newline at end of file
+}
+
+#endif
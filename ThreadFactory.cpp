@@ -1,15 +1,57 @@
 #include "ThreadFactory.h"
+#include "CpuTopology.h"
+
 namespace concurrency {
 std::shared_ptr<Thread> ThreadFactory::newThread(std::shared_ptr<Runnable> runnable) const {
   std::shared_ptr<Thread> result = std::make_shared<Thread>(isDetached(), runnable);
+  if (affinity_ != NO_AFFINITY) {
+    std::vector<int> cpus = nextCpus();
+    result->setAffinity(cpus, CpuTopology::nodeOf(cpus));
+  }
   runnable->thread(result);
   return result;
 }
 
+void ThreadFactory::setAffinity(AFFINITY policy, const std::vector<int> &cpus) {
+  if (policy == CPU_SET && cpus.empty()) {
+    throw std::exception();
+  }
+  affinity_ = policy;
+  cpus_ = cpus;
+  next_ = 0;
+}
+
+std::vector<int> ThreadFactory::nextCpus() const {
+  switch (affinity_) {
+  case CPU_SET:
+    return cpus_;
+  case ROUND_ROBIN: {
+    size_t slot = next_++;
+    if (!cpus_.empty()) {
+      return std::vector<int>(1, cpus_[slot % cpus_.size()]);
+    }
+    // every cpu of every node, in node order
+    slot %= CpuTopology::cpuCount();
+    for (size_t node = 0; node < CpuTopology::nodeCount(); node++) {
+      const std::vector<int> &nodeCpus = CpuTopology::nodeCpus(node);
+      if (slot < nodeCpus.size()) {
+        return std::vector<int>(1, nodeCpus[slot]);
+      }
+      slot -= nodeCpus.size();
+    }
+    return std::vector<int>(1, CpuTopology::nodeCpus(0).front());
+  }
+  case NUMA_NODES:
+    return CpuTopology::nodeCpus(next_++ % CpuTopology::nodeCount());
+  default:
+    return std::vector<int>();
+  }
+}
+
 /**
  * \return 获取当前线程id
 */
 Thread::id_t ThreadFactory::getCurrentThreadId() const {
   return std::this_thread::get_id();
 }
-}
\ No newline at end of file
+}
@@ -1,4 +1,9 @@
+#ifndef _CONCURRENCY_THREADFACTORY_H_
+#define _CONCURRENCY_THREADFACTORY_H_ 1
+
+#include <atomic>
 #include <memory>
+#include <vector>
 #include "Thread.h"
 
 namespace concurrency {
@@ -10,6 +15,22 @@ namespace concurrency {
  */
 class ThreadFactory final {
 public:
+  /**
+   * Where the threads created by the factory run, see setAffinity().
+   *
+   * 线程的CPU亲和性策略
+   */
+  enum AFFINITY {
+    // 不绑定，由操作系统调度
+    NO_AFFINITY,
+    // 每个线程都绑定到同一个CPU集合，单个CPU即绑定到该核
+    CPU_SET,
+    // 第k个线程绑定到第k % n个CPU
+    ROUND_ROBIN,
+    // 第k个线程绑定到第k % nodeCount()个NUMA节点的全部CPU
+    NUMA_NODES
+  };
+
   /**
    * detached ： 是否线程运行后分离线程
    * 
@@ -20,7 +41,7 @@ public:
    *
    * By default threads are not joinable.
    */
-  ThreadFactory(bool detached = true) : detached_(detached) { }
+  ThreadFactory(bool detached = true) : detached_(detached), affinity_(NO_AFFINITY), next_(0) { }
 
   ~ThreadFactory() = default;
 
@@ -34,6 +55,25 @@ public:
    */
   void setDetached(bool detached) { detached_ = detached; }
 
+  /**
+   * Sets where newly created threads run:
+   *   CPU_SET      every thread on cpus
+   *   ROUND_ROBIN  one thread per cpu in turn, over every cpu when cpus is empty
+   *   NUMA_NODES   one NUMA node per thread in turn, threads may run on any cpu
+   *                of their node; nodes are numbered as in CpuTopology
+   *
+   * Threads remember their node (Thread::numaNode()), which a work-stealing
+   * ThreadManager uses to keep tasks on the node they were added from.
+   * Meant to be called before the factory creates any thread.
+   *
+   * 设置新建线程的CPU亲和性
+   *
+   * \throws std::exception if cpus is empty for CPU_SET
+   */
+  void setAffinity(AFFINITY policy, const std::vector<int> &cpus = std::vector<int>());
+
+  AFFINITY getAffinity() const { return affinity_; }
+
   /**
    * Create a new thread.
    * 
@@ -47,6 +87,17 @@ public:
   Thread::id_t getCurrentThreadId() const;
 
 private:
+  /**
+   * The cpus the next thread is bound to, empty for no binding.
+   */
+  std::vector<int> nextCpus() const;
+
   bool detached_;
+  AFFINITY affinity_;
+  std::vector<int> cpus_;
+  // 已分配的线程数，用于轮流分配CPU或节点
+  mutable std::atomic<size_t> next_;
 };
-}
\ No newline at end of file
+}
+
+#endif
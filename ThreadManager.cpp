@@ -1,29 +1,259 @@
 #include "ThreadManager.h"
+#include "CpuTopology.h"
+#include "Futex.h"
 #include "Monitor.h"
 #include "Mutex.h"
+#include "TaskQueue.h"
+#include "Trace.h"
 
 #include <memory>
 
-#include <map>
+#include <atomic>
+#include <climits>
+#include <future>
 #include <deque>
 #include <set>
+#include <vector>
 #include <stdexcept>
+#include <algorithm>
 
 using std::dynamic_pointer_cast;
 using std::shared_ptr;
 using std::unique_ptr;
 
 namespace concurrency {
+constexpr ThreadManager::Task::time_point ThreadManager::Task::NO_EXPIRATION;
+
+/**
+ * Per-thread list of free tasks, owned by a Worker.
+ *
+ * 工作线程私有的空闲任务缓存
+ */
+struct TaskCache
+{
+    TaskCache() : head(nullptr), size(0) {}
+
+    ThreadManager::Task *head;
+    size_t size;
+};
+
+/**
+ * Counters of one worker, on their own cache lines.  Only the worker writes
+ * them, stats() sums them up from any thread.
+ *
+ * 单个worker的统计计数器，独占缓存行，只由该worker写入
+ */
+struct alignas(kCacheLineSize) WorkerCounters
+{
+    WorkerCounters() : executed(0), steals(0), parks(0) {}
+
+    /**
+   * Single writer increment: no read-modify-write needed
+   */
+    static void bump(std::atomic<uint64_t> &counter, uint64_t value = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    /**
+   * Adds the counters of a retiring worker, writers are serialized by the caller.
+   */
+    void merge(const WorkerCounters &other)
+    {
+        bump(executed, other.executed.load(std::memory_order_relaxed));
+        bump(steals, other.steals.load(std::memory_order_relaxed));
+        bump(parks, other.parks.load(std::memory_order_relaxed));
+        queueWait.merge(other.queueWait);
+        runTime.merge(other.runTime);
+    }
+
+    void addTo(ThreadManager::Stats &stats) const
+    {
+        stats.executedTaskCount += executed.load(std::memory_order_relaxed);
+        stats.stealCount += steals.load(std::memory_order_relaxed);
+        stats.parkCount += parks.load(std::memory_order_relaxed);
+        queueWait.addTo(stats.queueWait);
+        runTime.addTo(stats.runTime);
+    }
+
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> parks;
+    LatencyHistogram queueWait;
+    LatencyHistogram runTime;
+};
+
+/**
+ * Slab allocator for ThreadManager::Task.
+ *
+ * Tasks are allocated kSlabSize at a time and never returned to the heap
+ * before the pool itself is destroyed.  Free tasks live on a central list
+ * guarded by mutex_; worker threads keep a TaskCache and only touch the
+ * central list to move kBatchSize tasks at a time.
+ *
+ * 任务对象池：按slab批量分配任务对象，工作线程通过本地缓存获取和归还任务
+ */
+class TaskPool
+{
+public:
+    TaskPool() : free_(nullptr) {}
+
+    /**
+   * Takes a free task, from cache when given.
+   */
+    ThreadManager::Task *acquire(TaskCache *cache)
+    {
+        if (!cache)
+        {
+            Guard g(mutex_);
+            if (!free_)
+            {
+                grow();
+            }
+            ThreadManager::Task *task = free_;
+            free_ = task->next_;
+            return task;
+        }
+
+        if (!cache->head)
+        {
+            refill(*cache);
+        }
+        ThreadManager::Task *task = cache->head;
+        cache->head = task->next_;
+        cache->size--;
+        return task;
+    }
+
+    /**
+   * Gives a task back, to cache when given.
+   */
+    void release(ThreadManager::Task *task, TaskCache *cache)
+    {
+        task->clear();
+
+        if (!cache)
+        {
+            Guard g(mutex_);
+            task->next_ = free_;
+            free_ = task;
+            return;
+        }
+
+        task->next_ = cache->head;
+        cache->head = task;
+        if (++cache->size >= 2 * kBatchSize)
+        {
+            spill(*cache, kBatchSize);
+        }
+    }
+
+    /**
+   * Returns every task of a cache to the central list.
+   */
+    void flush(TaskCache &cache) { spill(cache, cache.size); }
+
+private:
+    static const size_t kSlabSize = 256;
+    static const size_t kBatchSize = 32;
+
+    /**
+   * Allocates a new slab and puts it on the central list, mutex_ must be held.
+   */
+    void grow()
+    {
+        unique_ptr<ThreadManager::Task[]> slab(new ThreadManager::Task[kSlabSize]);
+        for (size_t ix = 0; ix < kSlabSize; ix++)
+        {
+            slab[ix].next_ = free_;
+            free_ = &slab[ix];
+        }
+        slabs_.push_back(std::move(slab));
+    }
+
+    void refill(TaskCache &cache)
+    {
+        Guard g(mutex_);
+        for (size_t ix = 0; ix < kBatchSize; ix++)
+        {
+            if (!free_)
+            {
+                grow();
+            }
+            ThreadManager::Task *task = free_;
+            free_ = task->next_;
+            task->next_ = cache.head;
+            cache.head = task;
+            cache.size++;
+        }
+    }
+
+    void spill(TaskCache &cache, size_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        // detach count tasks from the cache then splice them in one go
+        ThreadManager::Task *first = cache.head;
+        ThreadManager::Task *last = first;
+        for (size_t ix = 1; ix < count; ix++)
+        {
+            last = last->next_;
+        }
+        cache.head = last->next_;
+        cache.size -= count;
+
+        Guard g(mutex_);
+        last->next_ = free_;
+        free_ = first;
+    }
+
+    Mutex mutex_;
+    ThreadManager::Task *free_;
+    std::vector<unique_ptr<ThreadManager::Task[]>> slabs_;
+};
+
+// the slabs keep every task on lines of its own, see ThreadManager::Task
+static_assert(sizeof(TaskFunction) + sizeof(uint64_t) <= kCacheLineSize, "a task's callable and state word share a line");
+static_assert(sizeof(ThreadManager::Task) == 2 * kCacheLineSize, "a task spans two cache lines");
+
 /**
  * ThreadManager class
  *
  * This class manages a pool of threads. It uses a ThreadFactory to create
  * threads.  It never actually creates or destroys worker threads, rather
  * it maintains statistics on number of idle threads, number of active threads,
- * task backlog, and average wait and service times.
+ * task backlog, and optionally histograms of wait and service times (see
+ * stats()).  Every counter is atomic: the getters never take mutex_.
  *
  * There are three different monitors used for signaling different conditions
- * however they all share the same mutex_.
+ * however they all share the same mutex_.  Idle workers do not wait on a
+ * monitor: each one parks on its own slot, on an intrusive LIFO stack, so
+ * that a new task wakes exactly one (cache-warm) worker and removing workers
+ * wakes exactly the ones that retire.
+ *
+ * The pending task queue tasks_ is pluggable (see TaskQueue.h).  The default
+ * std::deque backend is guarded by mutex_; with a lock-free backend producers
+ * and workers only take mutex_ to block on a full queue, to park and to wake
+ * up parked workers.
+ *
+ * In work-stealing mode each worker additionally owns a local task queue
+ * guarded by its own mutex, and tasks_ serves as the shared injection queue.
+ *
+ * Tasks with an expiration are also indexed in a min-heap on their expire
+ * time, watched by a reaper thread started with the first such task.  The
+ * reaper expires a task in place: it claims the task off its generation and
+ * state word, fires the expire callback, and leaves a DROPPED tombstone in
+ * the queue that the next dequeuer recycles.  No queue is scanned, and a full
+ * queue is only scanned for room when the index says something expired.
+ * cancel() drops a task the same way, through the generation of its TaskHandle.
+ *
+ * Delayed and periodic tasks wait in a second min-heap, timers_, guarded by
+ * mutex_.  There is no timer thread: one parked worker at a time sleeps
+ * until the earliest deadline, and any worker looking for a task moves the
+ * due timers into the pending queue first.
  *
  * @version $Id:$
  */
@@ -32,20 +262,51 @@ class ThreadManager::Impl : public ThreadManager
 
 public:
     Impl()
-        : workerCount_(0),
-          workerMaxCount_(0),
+        : pendingCount_(0),
+          maxWaiters_(0),
+          nodeCursor_(0),
           idleCount_(0),
-          pendingTaskCountMax_(0),
           expiredCount_(0),
+          tombstones_(0),
+          workerCount_(0),
+          workerMaxCount_(0),
+          pendingTaskCountMax_(0),
+          dequeueBatchSize_(1),
+          recordLatencies_(false),
+          saturation_(ThreadManager::BLOCK),
+          workStealing_(false),
+          numaLocal_(false),
           state_(ThreadManager::UNINITIALIZED),
+          nextTimer_(kNoTimer),
+          elasticMax_(0),
+          elasticQueueThreshold_(0),
+          elasticWaitThreshold_(0),
+          tasks_(new DequeTaskQueue<ThreadManager::Task *>()),
+          priorityTasks_(nullptr),
+          fairTasks_(nullptr),
           monitor_(&mutex_),
           maxMonitor_(&mutex_),
-          workerMonitor_(&mutex_) {}
+          workerMonitor_(&mutex_),
+          idleHead_(nullptr),
+          idleTail_(nullptr),
+          timerWatcher_(nullptr),
+          hotSpinners_(0),
+          expiryMonitor_(&expiryMutex_),
+          expiryCompactSize_(kExpiryCompactMin),
+          reaperRunning_(false),
+          reaperStopped_(false),
+          scaleRequested_(false),
+          scalerMonitor_(&scalerMutex_),
+          scalerRunning_(false),
+          scalerStopped_(false) {}
 
     ~Impl() override { stop(); }
 
     void start() override;
-    void stop() override;
+
+    void stop() override { stop(ThreadManager::DRAIN, 0); }
+
+    std::vector<shared_ptr<Runnable>> stop(ThreadManager::STOP_MODE mode, int64_t deadline) override;
 
     ThreadManager::STATE state() const override { return state_; }
 
@@ -64,6 +325,10 @@ public:
             throw std::exception();
         }
         threadFactory_ = value;
+        if (blocking_)
+        {
+            blocking_->threadFactory(value);
+        }
     }
 
     void addWorker(size_t value) override;
@@ -72,605 +337,3692 @@ public:
 
     size_t idleWorkerCount() const override { return idleCount_; }
 
-    size_t workerCount() const override
-    {
-        Guard g(mutex_);
-        return workerCount_;
-    }
+    size_t workerCount() const override { return workerCount_; }
 
-    size_t pendingTaskCount() const override
-    {
-        Guard g(mutex_);
-        return tasks_.size();
-    }
+    size_t pendingTaskCount() const override { return pendingCount_; }
+
+    size_t pendingTaskCount(ThreadManager::PRIORITY priority) const override;
+
+    size_t tenantPendingTaskCount(uint32_t tenant) const override;
 
     size_t totalTaskCount() const override
     {
-        Guard g(mutex_);
-        return tasks_.size() + workerCount_ - idleCount_;
+        // three separate reads: never let a stale idle count underflow the sum
+        const size_t workers = workerCount_;
+        const size_t idle = idleCount_;
+        return pendingCount_ + (workers > idle ? workers - idle : 0);
     }
 
-    size_t pendingTaskCountMax() const override
+    size_t pendingTaskCountMax() const override { return pendingTaskCountMax_; }
+
+    size_t expiredTaskCount() const override { return expiredCount_; }
+
+    ThreadManager::Stats stats() const override;
+
+    void recordLatencies(bool value) override
     {
-        Guard g(mutex_);
-        return pendingTaskCountMax_;
+        recordLatencies_ = value;
+        if (blocking_)
+        {
+            blocking_->recordLatencies(value);
+        }
     }
 
-    size_t expiredTaskCount() const override
+    void saturationPolicy(ThreadManager::SATURATION value) override
     {
-        Guard g(mutex_);
-        return expiredCount_;
+        saturation_ = value;
+        if (blocking_)
+        {
+            blocking_->saturationPolicy(value);
+        }
     }
 
+    ThreadManager::SATURATION saturationPolicy() const override { return saturation_; }
+
     void pendingTaskCountMax(const size_t value)
     {
         Guard g(mutex_);
+        // a bounded backend can not admit more than it can hold
+        if (tasks_->capacity() != 0 && (value == 0 || value > tasks_->capacity()))
+        {
+            throw std::exception();
+        }
         pendingTaskCountMax_ = value;
     }
 
-    void add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration) override;
+    /**
+   * Selects the work-stealing scheduler. Must be called before start().
+   *
+   * 开启工作窃取模式，需在start()之前调用
+   */
+    void workStealing(bool value)
+    {
+        Guard g(mutex_);
+        if (state_ != ThreadManager::UNINITIALIZED)
+        {
+            throw std::exception();
+        }
+        workStealing_ = value;
+    }
 
-    void remove(shared_ptr<Runnable> task) override;
+    typedef TaskQueue<ThreadManager::Task *> PendingQueue;
 
-    shared_ptr<Runnable> removeNextPending() override;
+    /**
+   * Replaces the pending task queue backend. Must be called before start().
+   *
+   * 替换挂起任务队列的实现，需在start()之前调用
+   */
+    void taskQueue(unique_ptr<PendingQueue> value)
+    {
+        Guard g(mutex_);
+        if (state_ != ThreadManager::UNINITIALIZED)
+        {
+            throw std::exception();
+        }
+        tasks_ = std::move(value);
+        priorityTasks_ = nullptr;
+        fairTasks_ = nullptr;
+    }
 
-    void removeExpiredTasks() override { removeExpired(false); }
+    /**
+   * Lane of a task in the priority queue
+   */
+    struct TaskPriority
+    {
+        size_t operator()(ThreadManager::Task *task) const { return task->getPriority(); }
+    };
 
-    void setExpireCallback(ExpireCallback expireCallback) override;
+    typedef PriorityTaskQueue<ThreadManager::Task *, TaskPriority> PriorityQueue;
 
-private:
     /**
-   * Remove one or more expired tasks.
-   * \param[in]  justOne  if true, try to remove just one task and return
+   * Replaces the pending task queue with one lane per priority level, see
+   * newPriorityThreadManager().  Must be called before start().
+   *
+   * 使用多优先级任务队列，需在start()之前调用
    */
-    void removeExpired(bool justOne);
+    void priorityLanes(int64_t aging)
+    {
+        PriorityQueue *queue = new PriorityQueue(ThreadManager::kPriorityLevels, std::chrono::milliseconds(aging));
+        taskQueue(unique_ptr<PendingQueue>(queue));
+        priorityTasks_ = queue;
+    }
 
     /**
-   * 根据当前线程id判断是否可阻塞
-   * \returns whether it is acceptable to block, depending on the current thread id
+   * Lane of a task in the fair queue
    */
-    bool canSleep() const;
+    struct TaskTenant
+    {
+        uint32_t operator()(ThreadManager::Task *task) const { return task->getTenant(); }
+    };
+
+    typedef FairTaskQueue<ThreadManager::Task *, TaskTenant> FairQueue;
 
     /**
-   * Lowers the maximum worker count and blocks until enough worker threads complete
-   * to get to the new maximum worker limit.  The caller is responsible for acquiring
-   * a lock on the class mutex_.
-   * 
-   * 移除指定数量的工作线程
+   * Replaces the pending task queue with one lane per tenant, see
+   * newFairThreadManager().  Must be called before start().
+   *
+   * 使用多租户公平队列，需在start()之前调用
    */
-    void removeWorkersUnderLock(size_t value);
+    void fairLanes(size_t quantum)
+    {
+        FairQueue *queue = new FairQueue(quantum);
+        taskQueue(unique_ptr<PendingQueue>(queue));
+        fairTasks_ = queue;
+    }
 
-    size_t workerCount_;
-    size_t workerMaxCount_;
-    size_t idleCount_;
-    size_t pendingTaskCountMax_;
-    size_t expiredCount_;
-    ExpireCallback expireCallback_;
+    using ThreadManager::add;
 
-    ThreadManager::STATE state_;
-    shared_ptr<ThreadFactory> threadFactory_;
+    TaskHandle add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration) override
+    {
+        return submit(TaskFunction(RunnableCall(std::move(value))), timeout, expiration);
+    }
 
-    friend class ThreadManager::Task;
-    typedef std::deque<shared_ptr<Task>> TaskQueue;
-    TaskQueue tasks_;
-    Mutex mutex_;
-    Monitor monitor_;
+    using ThreadManager::submit;
 
-    /**
-   * 任务队列最大监视器：通知任务队列中任务个数达到最大值或由最大值变为小于最大值
-  */
-    Monitor maxMonitor_;
-    Monitor workerMonitor_; // used to synchronize changes in worker count；用于通知worker工作者线程数改变
+    TaskHandle submit(TaskFunction &&task, int64_t timeout, int64_t expiration) override
+    {
+        return submit(std::move(task), saturation_.load(), timeout, expiration);
+    }
 
-    friend class ThreadManager::Worker;
-    /**
-   * 有效的工作线程集合（线程池）
-  */
-    std::set<shared_ptr<Thread>> workers_;
+    TaskHandle submit(TaskFunction &&task, ThreadManager::SATURATION policy, int64_t timeout, int64_t expiration) override;
 
-    /**
-   * 死亡的工作线程集合
-  */
-    std::set<shared_ptr<Thread>> deadWorkers_;
+    using ThreadManager::submitWithPriority;
 
-    /**
-   * 线程id和线程的键值型集合
-   * 保存了所有wokers中的线程
-  */
-    std::map<const Thread::id_t, shared_ptr<Thread>> idMap_;
-};
+    TaskHandle submitWithPriority(TaskFunction &&task,
+                                  ThreadManager::PRIORITY priority,
+                                  int64_t timeout,
+                                  int64_t expiration) override
+    {
+        return submitWithPriority(std::move(task), priority, saturation_.load(), timeout, expiration);
+    }
 
-/**
- * 可执行的任务类
- *
- * 使用代理模式封装了可执行的Runnable任务对象，可通过expireTime_控制等待任务执行的超时时间
- */
-class ThreadManager::Task : public Runnable
-{
+    TaskHandle submitWithPriority(TaskFunction &&task,
+                                  ThreadManager::PRIORITY priority,
+                                  ThreadManager::SATURATION policy,
+                                  int64_t timeout,
+                                  int64_t expiration) override;
 
-public:
-    enum STATE
+    using ThreadManager::submitWithTenant;
+
+    TaskHandle submitWithTenant(TaskFunction &&task, uint32_t tenant, int64_t timeout, int64_t expiration) override
     {
-        WAITING,
-        EXECUTING,
-        TIMEDOUT,
-        COMPLETE
-    };
+        return submitWithTenant(std::move(task), tenant, saturation_.load(), timeout, expiration);
+    }
+
+    TaskHandle submitWithTenant(TaskFunction &&task,
+                                uint32_t tenant,
+                                ThreadManager::SATURATION policy,
+                                int64_t timeout,
+                                int64_t expiration) override;
+
+    void tenantShare(uint32_t tenant, uint32_t weight, size_t pendingTaskCountMax) override;
+
+    void remove(shared_ptr<Runnable> task) override;
+
+    bool cancel(const TaskHandle &handle) override;
+
+    shared_ptr<Runnable> removeNextPending() override;
 
-    Task(shared_ptr<Runnable> runnable, uint64_t expiration = 0ULL)
-        : runnable_(runnable), state_(WAITING)
+    void blockingLane(size_t minWorkers, size_t maxWorkers, size_t pendingTaskCountMax, int64_t keepAlive) override;
+
+    using ThreadManager::submitBlocking;
+
+    TaskHandle submitBlocking(TaskFunction &&task, int64_t timeout, int64_t expiration) override
     {
-        if (expiration != 0ULL)
+        if (!blocking_)
         {
-            expireTime_.reset(new std::chrono::steady_clock::time_point(
-                std::chrono::steady_clock::now() + std::chrono::milliseconds(expiration)));
+            return submit(std::move(task), timeout, expiration);
         }
+        return blocking_->submit(std::move(task), timeout, expiration);
     }
 
-    ~Task() override = default;
+    TaskHandle addDelayed(shared_ptr<Runnable> task, int64_t delay) override { return scheduleTimer(std::move(task), delay, 0); }
 
-    // 只有在state_ == EXECUTING时才可被执行
-    void run() override
+    TaskHandle addPeriodic(shared_ptr<Runnable> task, int64_t interval) override
     {
-        if (state_ == EXECUTING)
+        if (interval <= 0)
         {
-            runnable_->run();
-            state_ = COMPLETE;
+            throw std::exception();
         }
+        return scheduleTimer(std::move(task), interval, interval);
     }
 
-    shared_ptr<Runnable> getRunnable() { return runnable_; }
-
-    /**
-   * 获取任务超时时间
-   */
-    const unique_ptr<std::chrono::steady_clock::time_point> &getExpireTime() const
+    void removeExpiredTasks() override
     {
-        return expireTime_;
+        {
+            ExpiredTasks expired(this);
+            Guard g(mutex_);
+            removeExpired(false, expired);
+        }
+        if (blocking_)
+        {
+            blocking_->removeExpiredTasks();
+        }
     }
 
-private:
-    shared_ptr<Runnable> runnable_;
-    friend class ThreadManager::Worker;
-    STATE state_;
-    unique_ptr<std::chrono::steady_clock::time_point> expireTime_;
-};
+    void setExpireCallback(ExpireCallback expireCallback) override;
 
-/**
- * 工作者线程
- * 负责从任务队列中获取队列，并执行任务
-*/
-class ThreadManager::Worker : public Runnable
-{
-    enum STATE
+    void setExpireBatchCallback(ExpireBatchCallback expireCallback) override;
+
+    void dequeueBatchSize(size_t value) override
     {
-        UNINITIALIZED,
-        STARTING,
-        STARTED,
-        STOPPING,
-        STOPPED
-    };
+        if (value == 0)
+        {
+            throw std::exception();
+        }
+        dequeueBatchSize_ = value;
+    }
 
-public:
-    Worker(ThreadManager::Impl *manager) : manager_(manager), state_(UNINITIALIZED) {}
+    size_t dequeueBatchSize() const override { return dequeueBatchSize_; }
 
-    ~Worker() override = default;
+    void setElasticPolicy(const ThreadManager::ElasticPolicy &policy) override;
 
-private:
-    /**
-   * 判断工作者线程是否需要继续处于活跃状态
-   * 1. 超过最大的工作者线程数了，需要减少工作者线程，则返回false；不需要处于活跃状态
-   * 2. 线程管理器处于JOINING状态，且任务队列已经为空，则返回false
-   * 3. 其他返回true
-   * 
-  */
-    bool isActive() const
+    ThreadManager::ElasticPolicy elasticPolicy() const override
     {
-        return (manager_->workerCount_ <= manager_->workerMaxCount_) || (manager_->state_ == JOINING && !manager_->tasks_.empty());
+        Guard g(mutex_);
+        return elastic_;
     }
 
-public:
-    /**
-   * Worker工作者的入口
-   * Worker entry point
+    void setIdlePolicy(const ThreadManager::IdlePolicy &policy) override
+    {
+        Guard g(mutex_);
+        idle_ = policy;
+        // polling and parked workers pick up the new policy when they park again
+        wakeIdleWorkersUnderLock(idleCount_);
+    }
+
+    ThreadManager::IdlePolicy idlePolicy() const override
+    {
+        Guard g(mutex_);
+        return idle_;
+    }
+
+protected:
+    ThreadManager::Task *acquireTask() override;
+
+    void enqueueTask(ThreadManager::Task *task, int64_t timeout) override { enqueueTask(task, timeout, saturation_.load()); }
+
+    size_t enqueueBatch(ThreadManager::Task *const *tasks, size_t count, int64_t timeout) override;
+
+    bool onWorkerThread() const override { return localWorker() != nullptr; }
+
+    bool runPendingTask() override;
+
+private:
+    /**
+   * Expired tasks collected under mutex_.  They are handed to the expire
+   * callback when the collection goes out of scope, so declared before the
+   * Guard it only calls back once the lock was released.
    *
-   * As long as worker thread is running, pull tasks off the task queue and
-   * execute.
+   * 持锁时收集过期任务，析构时（锁已释放）再批量调用过期回调
    */
-    void run() override
+    class ExpiredTasks
+    {
+    public:
+        explicit ExpiredTasks(Impl *manager) : manager_(manager) {}
+
+        ExpiredTasks(const ExpiredTasks &) = delete;
+        ExpiredTasks &operator=(const ExpiredTasks &) = delete;
+
+        ~ExpiredTasks()
+        {
+            if (!tasks_.empty())
+            {
+                manager_->expireTasks(tasks_.data(), tasks_.size());
+            }
+        }
+
+        void push(ThreadManager::Task *task) { tasks_.push_back(task); }
+
+    private:
+        Impl *manager_;
+        std::vector<ThreadManager::Task *> tasks_;
+    };
+
+    /**
+   * Remove one or more expired tasks.  Nothing is scanned unless expiryDue().
+   * The caller must hold mutex_.
+   * \param[in]  justOne  if true, try to remove just one task and return
+   * \param[out] expired  receives the tasks to hand to the expire callback
+   */
+    void removeExpired(bool justOne, ExpiredTasks &expired);
+
+    /**
+   * Entry of the expiry index.  Entries are never removed when their task
+   * runs: a task that is reused or no longer WAITING simply does not match.
+   */
+    struct Expiry
+    {
+        ThreadManager::Task::time_point expireTime;
+        ThreadManager::Task *task;
+        uint32_t generation;
+
+        bool operator>(const Expiry &other) const { return expireTime > other.expireTime; }
+    };
+
+    /**
+   * \returns the expiry index entry of a task that is about to be queued; it
+   * must be taken before the push, once queued the task may be reused
+   */
+    static Expiry expiryOf(ThreadManager::Task *task)
+    {
+        return Expiry{task->getExpireTime(), task, task->getGeneration()};
+    }
+
+    /**
+   * Adds queued tasks to the expiry index, starting the reaper if needed.
+   * The caller may hold mutex_.
+   *
+   * 将已入队的任务加入过期索引（最小堆）
+   */
+    void watchExpiries(const Expiry *expiries, size_t count);
+
+    /**
+   * Whether a queue may hold an expired task: a reaped tombstone or an index
+   * entry past its time.
+   */
+    bool expiryDue(const ThreadManager::Task::time_point &now) const;
+
+    /**
+   * Drops the index entries whose task left the queues, expiryMutex_ must be held.
+   */
+    void compactExpiriesUnderLock();
+
+    /**
+   * Main loop of the reaper thread: sleeps until the earliest expire time,
+   * then expires the due tasks that are still queued.
+   *
+   * 过期回收线程：主动触发过期回调，而不是等到出队时才发现过期
+   */
+    void reapExpired();
+
+    /**
+   * Expires the tasks of due entries that are still queued, leaving
+   * tombstones, then calls the expire callback without holding any lock.
+   */
+    void reapDue(std::vector<Expiry> &due);
+
+    /**
+   * Entry of the timer heap.  A cancelled task is left in the heap as a
+   * DROPPED tombstone, recycled when its entry comes due.
+   */
+    struct Timer
+    {
+        ThreadManager::Task::time_point due;
+        ThreadManager::Task *task;
+
+        bool operator>(const Timer &other) const { return due > other.due; }
+    };
+
+    static constexpr int64_t kNoTimer = INT64_MAX;
+
+    /**
+   * Puts a task of addDelayed() or addPeriodic() in the timer heap, to run
+   * delay milliseconds from now and then every period milliseconds.
+   */
+    TaskHandle scheduleTimer(shared_ptr<Runnable> value, int64_t delay, int64_t period);
+
+    /**
+   * Adds a task to the timer heap at its dueTime_, moving it to the queue
+   * right away if it is already due.  The caller must hold mutex_.
+   */
+    void addTimerUnderLock(ThreadManager::Task *task);
+
+    /**
+   * Moves the due timers into the pending queue, as far as there is room,
+   * and wakes one idle worker per task.  The caller must hold mutex_.
+   */
+    void promoteTimersUnderLock();
+
+    /**
+   * promoteTimersUnderLock() if the earliest timer is due, read from
+   * nextTimer_ without a lock.  The caller must hold mutex_ when locked is true.
+   */
+    void promoteDueTimers(bool locked);
+
+    /**
+   * Makes sure that a parked worker sleeps until the next deadline: with
+   * timers left and no watcher, an idle worker is woken and takes the watch
+   * when it parks again.  The caller must hold mutex_.
+   */
+    void watchTimersUnderLock();
+
+    /**
+   * Puts a periodic task that just completed back into the timer heap.
+   * \returns false if the task must be recycled: the manager is stopping
+   */
+    bool reschedule(ThreadManager::Task *task);
+
+    /**
+   * Stops the reaper thread, the caller must not hold mutex_.
+   */
+    void stopReaper();
+
+    /**
+   * Takes ownership of a task just taken off a queue, see Task::claim().
+   * A tombstone left by the reaper is recycled here.
+   * \returns false if the caller must forget the task
+   */
+    bool claimDequeued(ThreadManager::Task *task, ThreadManager::Task::STATE state);
+
+    /**
+   * Queues a task, a full queue is handled according to policy.
+   * \returns false if the policy gave the task up or ran it on the calling thread
+   */
+    bool enqueueTask(ThreadManager::Task *task, int64_t timeout, ThreadManager::SATURATION policy);
+
+    /**
+   * Queues a task, enqueueTask() without the expiry index.
+   * \returns false if the policy refused the task, see refuseTask()
+   */
+    bool queueTask(ThreadManager::Task *task, int64_t timeout, ThreadManager::SATURATION policy);
+
+    /**
+   * Takes a pending slot for a task about to be queued.  When the queue is
+   * full an expired task is removed first, then policy decides: DROP_OLDEST
+   * evicts the oldest pending task into expired (the oldest of the task's
+   * tenant if that tenant is full), BLOCK waits (if canSleep()
+   * and timeout >= 0), REJECT and CALLER_RUNS give up.  The caller must hold
+   * mutex_.
+   * \returns false if the task must be refused
+   * \throws std::exception when BLOCK can not wait, or it timed out
+   */
+    bool reservePendingUnderLock(ThreadManager::Task *task,
+                                 ThreadManager::SATURATION policy,
+                                 int64_t timeout,
+                                 ExpiredTasks &expired);
+
+    /**
+   * DROP_OLDEST: takes the front of the shared queue, or of a worker's local
+   * queue, and keeps its pending slot for the caller.  The caller must hold
+   * mutex_.
+   * \returns false if no queued task was found
+   */
+    bool evictOldestUnderLock(ExpiredTasks &expired);
+
+    /**
+   * Disposes of a task that was not queued: CALLER_RUNS runs it on the
+   * calling thread, otherwise an async() Future completes with
+   * broken_promise.  The caller must not hold mutex_.
+   *
+   * 处理未能入队的任务：CALLER_RUNS在调用线程上执行，否则直接丢弃
+   */
+    void refuseTask(ThreadManager::Task *task, ThreadManager::SATURATION policy);
+
+    /**
+   * 根据当前线程是否为本管理器的工作线程判断是否可阻塞
+   * \returns whether it is acceptable to block: false on this manager's workers
+   */
+    bool canSleep() const { return localWorker() == nullptr; }
+
+    /**
+   * The worker running on the calling thread if it belongs to this manager,
+   * read from a thread_local tag: O(1) and lock-free.
+   *
+   * 当前线程是本管理器的工作线程时返回该worker，否则返回nullptr
+   */
+    ThreadManager::Worker *localWorker() const;
+
+    /**
+   * Lowers the maximum worker count and blocks until enough worker threads complete
+   * to get to the new maximum worker limit.  The caller is responsible for acquiring
+   * a lock on the class mutex_.
+   *
+   * 移除指定数量的工作线程
+   */
+    void removeWorkersUnderLock(size_t value);
+
+    /**
+   * Joins (joinable thread factory) and forgets the workers that retired,
+   * the caller must hold mutex_.
+   */
+    void reapDeadWorkersUnderLock();
+
+    /**
+   * Elastic pool: asks the scaler for a new worker when every worker is busy
+   * with at least queueThreshold tasks pending, checked by add() and by
+   * workers taking a task.  Only reads atomics unless it has to notify.
+   */
+    void checkBacklog()
+    {
+        const size_t threshold = elasticQueueThreshold_;
+        if (threshold > 0 && idleCount_ == 0 && pendingCount_ >= threshold &&
+            workerMaxCount_ < elasticMax_ && !scaleRequested_.exchange(true))
+        {
+            requestScale();
+        }
+    }
+
+    /**
+   * Wakes up the scaler thread, starting it on first use.  May be called
+   * holding mutex_.
+   */
+    void requestScale();
+
+    /**
+   * Scaler thread main loop: adds workers on request or once tasks waited
+   * too long, and reaps retired workers.
+   */
+    void scaleWorkers();
+
+    /**
+   * Number of workers the scaler should add now; trims the pool down to
+   * maxWorkers without waiting.  The caller must hold mutex_.
+   *
+   * \param[in,out]  backlogSince  since when every worker has been busy with
+   *                              tasks pending, zero when they have not
+   */
+    size_t elasticDemandUnderLock(const ThreadManager::Task::time_point &now, ThreadManager::Task::time_point &backlogSince);
+
+    /**
+   * Stops the scaler thread, the caller must not hold mutex_.
+   */
+    void stopScaler();
+
+    /**
+   * Reserves one slot against pendingTaskCountMax_.  The slot is released
+   * when the task is dequeued (see releasePending()).
+   *
+   * 预占一个挂起任务名额，队列已满时返回false
+   */
+    bool tryReservePending();
+
+    /**
+   * tryReservePending() for task, which a fair queue also refuses while the
+   * queue of its tenant is full.  The caller must hold mutex_.
+   */
+    bool tryReserveUnderLock(ThreadManager::Task *task);
+
+    /**
+   * Reserves up to count slots at once.
+   * \returns the number of slots reserved, 0 if the queue is full
+   */
+    size_t reservePending(size_t count);
+
+    /**
+   * Releases a slot reserved by tryReservePending() and wakes up a producer
+   * blocked in add() if there is one.  The caller must hold mutex_ when locked
+   * is true.
+   */
+    void releasePending(bool locked);
+
+    /**
+   * Wakes up one producer blocked in add() on a full queue, if any.
+   * The caller must hold mutex_ when locked is true.
+   */
+    void notifyAddWaiters(bool locked);
+
+    /**
+   * Adds a task to the local queue of the calling worker (work-stealing mode).
+   * \returns false if policy refused the task
+   */
+    bool addLocal(ThreadManager::Worker *worker, ThreadManager::Task *task, ThreadManager::SATURATION policy);
+
+    /**
+   * Work-stealing with workers on several NUMA nodes: queues a task added
+   * from a non-worker thread on a worker of the caller's node, preferring an
+   * idle one.  Workers of other nodes only get it by stealing when idle.
+   * \returns false if the caller's node is unknown, the queue is full, the
+   *          manager is not started or no worker of the node accepts the
+   *          task; it then goes through the shared queue
+   *
+   * NUMA本地化：把任务放到调用线程所在节点的worker本地队列
+   */
+    bool queueOnNode(ThreadManager::Task *task);
+
+    /**
+   * Takes a task from the pool, through the calling worker's cache if any.
+   *
+   * 从任务对象池中获取一个任务对象
+   */
+    ThreadManager::Task *newTask(TaskFunction &&value, int64_t expiration);
+
+    /**
+   * Gives a task that left the queues back to the pool, or only drops the
+   * manager's reference to an async() task whose Future may still hold it.
+   *
+   * 将任务对象归还到任务对象池
+   */
+    void recycleTask(ThreadManager::Task *task);
+
+    /**
+   * Returns an unreferenced task to the pool, through the calling worker's
+   * cache if any.
+   */
+    void freeTask(ThreadManager::Task *task);
+
+    /**
+   * Both expire callbacks, replaced as a whole and read without mutex_
+   */
+    struct ExpireCallbacks
+    {
+        ExpireCallback single;
+        ExpireBatchCallback batch;
+    };
+
+    /**
+   * Counts, hands to the expire callback and recycles tasks that were taken
+   * off the queues and will not run; without a callback an async() task
+   * completes its Future with broken_promise.  The caller must not hold
+   * mutex_: the callback runs on the calling thread, once for the whole
+   * batch if a batch callback is set.
+   *
+   * 处理过期任务：在锁外调用过期回调
+   */
+    void expireTasks(ThreadManager::Task *const *tasks, size_t count);
+
+    /**
+   * Calls the expire callback, logging what it throws.
+   */
+    static void fireExpireCallbacks(const ExpireCallbacks &callbacks, const std::vector<shared_ptr<Runnable>> &runnables);
+
+    /**
+   * The calling worker's task cache, if it belongs to this manager.
+   */
+    TaskCache *workerCache() const;
+
+    /**
+   * Pushes a task that already holds a slot from tryReservePending().
+   */
+    void pushReserved(ThreadManager::Task *task);
+
+    /**
+   * Wakes up one parked worker after a task was published without holding
+   * mutex_.  The slot must have been reserved before the task was pushed.
+   */
+    void notifyIdleWorker();
+
+    /**
+   * Pushes the calling worker on the idle stack and blocks on its own
+   * parking slot until wakeIdleWorkersUnderLock() picks it.  Entered and left
+   * holding mutex_, which is released while parked.
+   *
+   * 工作线程在自己的停车位上阻塞，只有被选中时才会被唤醒
+   */
+    void parkUnderLock(ThreadManager::Worker *worker);
+
+    /**
+   * Polls for a wake-up before a worker parks, see IdlePolicy; hot workers
+   * poll until something happens.  Called without holding mutex_.
+   * \returns true if the worker was woken up, a task is pending or a
+   * timer came due, false if it should block on its parking slot
+   */
+    bool spinUnderPark(ThreadManager::Worker *worker, uint32_t word, const ThreadManager::IdlePolicy &policy, bool hot);
+
+    /**
+   * Wakes up to count parked workers, the most recently parked (cache-warm)
+   * first, or the least recently parked first when coldest is true.  With
+   * an IdlePolicy that polls, a polling worker goes before them.  The
+   * caller must hold mutex_.
+   * \returns the number of workers woken up
+   */
+    size_t wakeIdleWorkersUnderLock(size_t count, bool coldest = false);
+
+    /**
+   * Wakes up one given parked worker, the caller must hold mutex_.
+   */
+    void wakeWorkerUnderLock(ThreadManager::Worker *worker);
+
+    /**
+   * Takes a worker off the idle stack, the caller must hold mutex_.
+   */
+    void unlinkIdleUnderLock(ThreadManager::Worker *worker);
+
+    /**
+   * Whether workers dequeue without holding mutex_ (work-stealing mode or a
+   * lock-free pending queue).
+   */
+    bool unlockedDequeue() const { return workStealing_ || tasks_->isLockFree(); }
+
+    /**
+   * Publishes a new snapshot of the running workers, stolen from in
+   * work-stealing mode and summed up by stats().  The caller must hold mutex_.
+   *
+   * 更新正在运行的worker列表快照
+   */
+    void publishWorkersUnderLock();
+
+    /**
+   * Takes every task off the shared and the local queues for stop(), claimed
+   * in state; tombstones are dropped.  The caller must hold mutex_.
+   */
+    void takePendingUnderLock(ThreadManager::Task::STATE state, std::vector<ThreadManager::Task *> &tasks);
+
+    /**
+   * Adds the counters of the running and retired workers to stats.
+   */
+    void addCountersTo(ThreadManager::Stats &stats) const;
+
+    /**
+   * The members are grouped by who writes them, each group starting on a
+   * cache line of its own: the counters every add() and dequeue touch, the
+   * idle bookkeeping of the workers, the settings read on every hot path
+   * and written almost never, then mutex_ and the state it guards.
+   *
+   * 成员按写入方分组，每组独占缓存行，避免生产者、消费者与只读配置之间的伪共享
+   */
+
+    /**
+   * 挂起任务个数（共享队列与所有worker本地队列之和，包含已预占的名额）
+   */
+    alignas(kCacheLineSize) std::atomic<size_t> pendingCount_;
+
+    /**
+   * 阻塞在add()中等待队列空位的生产者个数
+   */
+    std::atomic<size_t> maxWaiters_;
+
+    /**
+   * queueOnNode()轮流选择worker的游标
+   */
+    std::atomic<size_t> nodeCursor_;
+
+    alignas(kCacheLineSize) std::atomic<size_t> idleCount_;
+    std::atomic<size_t> expiredCount_;
+
+    /**
+   * 过期回收线程留在队列中、尚未被出队回收的任务个数
+   */
+    std::atomic<size_t> tombstones_;
+
+    alignas(kCacheLineSize) std::atomic<size_t> workerCount_;
+    std::atomic<size_t> workerMaxCount_;
+    std::atomic<size_t> pendingTaskCountMax_;
+
+    /**
+   * 工作线程每次加锁批量获取的最大任务数
+   */
+    std::atomic<size_t> dequeueBatchSize_;
+
+    /**
+   * 是否记录任务等待时间和执行时间
+   */
+    std::atomic<bool> recordLatencies_;
+
+    /**
+   * 队列满时的默认处理策略
+   */
+    std::atomic<ThreadManager::SATURATION> saturation_;
+
+    bool workStealing_;
+
+    /**
+   * 快照中的worker是否分布在多个NUMA节点上
+   */
+    std::atomic<bool> numaLocal_;
+
+    std::atomic<ThreadManager::STATE> state_;
+
+    /**
+   * 最早的定时任务到期时间，供无锁检查；定时任务堆见timers_
+   */
+    std::atomic<int64_t> nextTimer_;
+
+    /**
+   * elastic_的副本，供add()和伸缩线程无锁读取
+   */
+    std::atomic<size_t> elasticMax_;
+    std::atomic<size_t> elasticQueueThreshold_;
+    std::atomic<int64_t> elasticWaitThreshold_;
+
+    /**
+   * 任务对象池，需在任务队列之前声明，保证最后析构
+   */
+    TaskPool taskPool_;
+
+    /**
+   * 任务队列；工作窃取模式下作为共享的注入队列，接收非worker线程添加的任务
+   */
+    unique_ptr<PendingQueue> tasks_;
+
+    /**
+   * tasks_ when it is a PriorityQueue, nullptr otherwise
+   */
+    PriorityQueue *priorityTasks_;
+
+    /**
+   * tasks_ when it is a FairQueue, nullptr otherwise
+   */
+    FairQueue *fairTasks_;
+
+    /**
+   * 过期回调，写时复制，通过std::atomic_load无锁读取；未设置时为空
+   */
+    shared_ptr<const ExpireCallbacks> expireCallbacks_;
+
+    /**
+   * Copy-on-write snapshot of the running workers, read without mutex_ by
+   * thieves and stats() via std::atomic_load and replaced under mutex_.
+   *
+   * 正在运行的worker快照
+   */
+    typedef std::vector<shared_ptr<ThreadManager::Worker>> WorkerList;
+    shared_ptr<const WorkerList> stealableWorkers_;
+
+    friend class ThreadManager::Task;
+
+    alignas(kCacheLineSize) Mutex mutex_;
+    Monitor monitor_;
+
+    /**
+   * 任务队列最大监视器：通知任务队列中任务个数达到最大值或由最大值变为小于最大值
+  */
+    Monitor maxMonitor_;
+    Monitor workerMonitor_; // used to synchronize changes in worker count；用于通知worker工作者线程数改变
+
+    /**
+   * 空闲worker的侵入式LIFO栈（双向链表），栈顶为最近进入空闲的worker，由mutex_保护
+   */
+    ThreadManager::Worker *idleHead_;
+    ThreadManager::Worker *idleTail_;
+
+    /**
+   * 睡眠到最早到期时间的空闲worker，nullptr表示无人值守
+   */
+    ThreadManager::Worker *timerWatcher_;
+
+    /**
+   * 空闲等待策略，以及当前不停车忙等的worker个数，由mutex_保护
+   */
+    ThreadManager::IdlePolicy idle_;
+    size_t hotSpinners_;
+
+    /**
+   * 定时任务：按到期时间排序的最小堆，由mutex_保护
+   */
+    std::vector<Timer> timers_;
+
+    /**
+   * 已退出的worker累计的计数器，由mutex_保护写入
+   */
+    WorkerCounters retiredCounters_;
+
+    shared_ptr<ThreadFactory> threadFactory_;
+
+    friend class ThreadManager::Worker;
+    /**
+   * 工作线程表（线程池），按worker的槽位号索引，空位为nullptr，
+   * 空闲槽位记录在freeSlots_中以便复用
+  */
+    std::vector<shared_ptr<Thread>> workers_;
+    std::vector<size_t> freeSlots_;
+
+    /**
+   * 已退出、尚未回收的工作线程槽位
+  */
+    std::vector<size_t> deadWorkers_;
+
+    /**
+   * 过期索引：按过期时间排序的最小堆，由expiryMutex_保护
+   */
+    static constexpr size_t kExpiryCompactMin = 1024;
+    std::vector<Expiry> expiries_;
+    Mutex expiryMutex_;
+    Monitor expiryMonitor_;
+    size_t expiryCompactSize_;
+    shared_ptr<Thread> reaper_;
+    bool reaperRunning_;
+    bool reaperStopped_;
+    friend class ExpiryReaper;
+
+    /**
+   * 弹性伸缩策略，由mutex_保护
+   */
+    ThreadManager::ElasticPolicy elastic_;
+
+    /**
+   * 伸缩线程：按需增加工作线程并回收已退出的线程，由scalerMutex_保护
+   */
+    std::atomic<bool> scaleRequested_;
+    Mutex scalerMutex_;
+    Monitor scalerMonitor_;
+    shared_ptr<Thread> scaler_;
+    bool scalerRunning_;
+    bool scalerStopped_;
+    friend class ElasticScaler;
+
+    /**
+   * 阻塞任务通道：独立的弹性线程管理器，start()之前由blockingLane()创建，之后只读；
+   * 持有mutex_时可以调用它（锁顺序：本管理器先于通道），它从不回调本管理器
+   */
+    unique_ptr<ThreadManager::Impl> blocking_;
+};
+
+namespace {
+/**
+ * 当前线程正在执行的Worker（及其所属的管理器和槽位），非工作线程为nullptr
+ */
+thread_local ThreadManager::Worker *currentWorker = nullptr;
+}
+
+/**
+ * 工作者线程
+ * 负责从任务队列中获取队列，并执行任务
+*/
+class ThreadManager::Worker : public Runnable
+{
+    enum STATE
+    {
+        UNINITIALIZED,
+        STARTING,
+        STARTED,
+        STOPPING,
+        STOPPED
+    };
+
+public:
+    Worker(ThreadManager::Impl *manager)
+        : manager_(manager),
+          state_(UNINITIALIZED),
+          slot_(0),
+          node_(-1),
+          localClosed_(false),
+          victimSeed_(0),
+          parkWord_(0),
+          spinning_(false),
+          parked_(false),
+          idlePrev_(nullptr),
+          idleNext_(nullptr) {}
+
+    ~Worker() override = default;
+
+private:
+    /**
+   * 判断工作者线程是否需要继续处于活跃状态
+   * 1. 超过最大的工作者线程数了，需要减少工作者线程，则返回false；不需要处于活跃状态
+   * 2. 线程管理器处于JOINING状态，且任务队列已经为空，则返回false
+   * 3. 其他返回true
+   *
+  */
+    bool isActive() const
+    {
+        return (manager_->workerCount_ <= manager_->workerMaxCount_) || (manager_->state_ == JOINING && manager_->pendingCount_ > 0);
+    }
+
+    /**
+   * The state a freshly dequeued task is claimed in: EXECUTING, or TIMEDOUT
+   * if its expiration has passed.
+   */
+    static ThreadManager::Task::STATE admit(const ThreadManager::Task *task)
+    {
+        // If the state is changed to anything other than EXECUTING or TIMEDOUT here
+        // then the execution loop needs to be changed below.
+        return (task->hasExpireTime() && task->isExpired(std::chrono::steady_clock::now()))
+                   ? ThreadManager::Task::TIMEDOUT
+                   : ThreadManager::Task::EXECUTING;
+    }
+
+    /**
+   * admit() for a batch, against a single reading of the clock.
+   */
+    static ThreadManager::Task::STATE admit(const ThreadManager::Task *task, const ThreadManager::Task::time_point &now)
+    {
+        return (task->hasExpireTime() && task->isExpired(now))
+                   ? ThreadManager::Task::TIMEDOUT
+                   : ThreadManager::Task::EXECUTING;
+    }
+
+    /**
+   * Takes up to dequeueBatchSize_ tasks off the locked shared queue into
+   * batch_, leaving idle peers their share.  The caller must hold
+   * manager_->mutex_.
+   *
+   * 加锁一次批量取出多个任务
+   */
+    void takeBatchUnderLock()
+    {
+        size_t limit = manager_->dequeueBatchSize_;
+        if (limit > 1)
+        {
+            size_t share = (manager_->tasks_->size() + manager_->idleCount_) / (manager_->idleCount_ + 1);
+            limit = std::max(static_cast<size_t>(1), std::min(limit, share));
+        }
+
+        ThreadManager::Task *task = nullptr;
+        while (batch_.size() < limit && manager_->tasks_->pop(task))
+        {
+            CONCURRENCY_TRACE(DEQUEUE, task, task->getGeneration());
+            batch_.push_back(task);
+        }
+
+        if (!batch_.empty())
+        {
+            /* If we have a pending task max and we just dropped below it, wakeup any
+          thread that might be blocked on add. */
+            manager_->pendingCount_ -= batch_.size();
+            manager_->notifyAddWaiters(true);
+        }
+    }
+
+    /**
+   * Runs an EXECUTING task, the caller must not hold manager_->mutex_.
+   */
+    void execute(ThreadManager::Task *task)
+    {
+        if (manager_->recordLatencies_.load(std::memory_order_relaxed))
+        {
+            const auto start = std::chrono::steady_clock::now();
+            if (task->enqueueTime_ != ThreadManager::Task::time_point())
+            {
+                counters_.queueWait.record(nanosSince(task->enqueueTime_, start));
+            }
+            run(task);
+            counters_.runTime.record(nanosSince(start, std::chrono::steady_clock::now()));
+        }
+        else
+        {
+            run(task);
+        }
+        WorkerCounters::bump(counters_.executed);
+    }
+
+    static uint64_t nanosSince(const ThreadManager::Task::time_point &from, const ThreadManager::Task::time_point &to)
+    {
+        return to > from ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count()) : 0;
+    }
+
+    static void run(ThreadManager::Task *task)
+    {
+        CONCURRENCY_TRACE(START, task, task->getGeneration());
+        try
+        {
+            task->run();
+        }
+        catch (const std::exception &e)
+        {
+            printf("[ERROR] task->run() raised an exception: %s", e.what());
+        }
+        catch (...)
+        {
+            printf("[ERROR] task->run() raised an unknown exception");
+        }
+        CONCURRENCY_TRACE(FINISH, nullptr, 0);
+    }
+
+    /**
+   * Work-stealing: pops from the back of the local queue (most recently
+   * pushed, cache-warm task first).
+   */
+    ThreadManager::Task *popLocal()
+    {
+        Guard g(localMutex_);
+        if (localTasks_.empty())
+        {
+            return nullptr;
+        }
+        ThreadManager::Task *task = localTasks_.back();
+        localTasks_.pop_back();
+        return task;
+    }
+
+    /**
+   * Work-stealing: takes the oldest half of the local queue, called by thieves.
+   */
+    void stealInto(std::vector<ThreadManager::Task *> &stolen)
+    {
+        Guard g(localMutex_);
+        size_t count = (localTasks_.size() + 1) / 2;
+        for (size_t ix = 0; ix < count; ix++)
+        {
+            stolen.push_back(localTasks_.front());
+            localTasks_.pop_front();
+        }
+    }
+
+    /**
+   * Takes the next task from the shared queue.  In work-stealing mode a batch
+   * is moved into the local queue as well.  The caller must hold manager_->mutex_
+   * unless the queue is lock-free.
+   *
+   * 从共享注入队列中批量获取任务，减少对共享队列的争用
+   */
+    ThreadManager::Task *takeShared()
+    {
+        ThreadManager::Task *task = nullptr;
+        if (!manager_->tasks_->pop(task) || !manager_->workStealing_)
+        {
+            return task;
+        }
+
+        size_t workers = manager_->workerCount_ > 0 ? manager_->workerCount_.load() : 1;
+        size_t batch = std::min(manager_->tasks_->size() / workers, static_cast<size_t>(kInjectBatchMax));
+        if (batch > 0)
+        {
+            Guard g(localMutex_);
+            ThreadManager::Task *next = nullptr;
+            for (size_t ix = 0; ix < batch && manager_->tasks_->pop(next); ix++)
+            {
+                localTasks_.push_front(std::move(next));
+            }
+        }
+        return task;
+    }
+
+    /**
+   * Work-stealing: tries peers starting at a pseudo-random victim, keeps the
+   * first stolen task and queues the rest locally.  When workers are spread
+   * over NUMA nodes, peers on the same node are tried before the others.
+   */
+    ThreadManager::Task *steal()
+    {
+        shared_ptr<const ThreadManager::Impl::WorkerList> workers = std::atomic_load(&manager_->stealableWorkers_);
+        if (!workers || workers->size() < 2)
+        {
+            return nullptr;
+        }
+
+        // xorshift, only used to spread thieves over victims
+        victimSeed_ ^= victimSeed_ << 13;
+        victimSeed_ ^= victimSeed_ >> 7;
+        victimSeed_ ^= victimSeed_ << 17;
+
+        std::vector<ThreadManager::Task *> stolen;
+        size_t offset = static_cast<size_t>(victimSeed_ % workers->size());
+        const bool local = node_ >= 0 && manager_->numaLocal_;
+        for (int pass = local ? 0 : 1; pass < 2 && stolen.empty(); pass++)
+        {
+            // pass 0: same node only, pass 1: anyone (the same node again is cheap)
+            for (size_t ix = 0; ix < workers->size() && stolen.empty(); ix++)
+            {
+                ThreadManager::Worker *victim = (*workers)[(offset + ix) % workers->size()].get();
+                if (victim != this && (pass == 1 || victim->node_ == node_))
+                {
+                    victim->stealInto(stolen);
+                }
+            }
+        }
+
+        if (stolen.empty())
+        {
+            return nullptr;
+        }
+        WorkerCounters::bump(counters_.steals);
+        CONCURRENCY_TRACE(STEAL, nullptr, static_cast<uint32_t>(stolen.size()));
+
+        if (stolen.size() > 1)
+        {
+            Guard g(localMutex_);
+            localTasks_.insert(localTasks_.begin(), stolen.begin() + 1, stolen.end());
+        }
+        return stolen.front();
+    }
+
+    /**
+   * Local queue first (work-stealing mode), then the shared queue, then peers.
+   * The caller must hold manager_->mutex_ when locked is true.
+   */
+    ThreadManager::Task *findTask(bool locked)
+    {
+        manager_->promoteDueTimers(locked);
+
+        ThreadManager::Task *task = nullptr;
+        if (manager_->workStealing_)
+        {
+            task = popLocal();
+        }
+        if (!task)
+        {
+            if (locked || manager_->tasks_->isLockFree())
+            {
+                task = takeShared();
+            }
+            else
+            {
+                Guard g(manager_->mutex_);
+                task = takeShared();
+            }
+        }
+        if (!task && manager_->workStealing_)
+        {
+            task = steal();
+        }
+        if (task)
+        {
+            // the slot is released as soon as the task leaves the queues so that
+            // a parking worker never waits on a count nobody can decrement
+            --manager_->pendingCount_;
+            CONCURRENCY_TRACE(DEQUEUE, task, task->getGeneration());
+        }
+        return task;
+    }
+
+    /**
+   * Work-stealing: hands the local queue back to the injection queue when
+   * the worker retires.  The caller must hold manager_->mutex_.
+   */
+    void flushLocalUnderLock()
+    {
+        Guard g(localMutex_);
+        // producers on other threads must not push onto a queue nobody drains
+        localClosed_ = true;
+        if (localTasks_.empty())
+        {
+            return;
+        }
+        for (auto &task : localTasks_)
+        {
+            // the tasks hold reserved slots, so even a bounded queue has room for them
+            manager_->pushReserved(std::move(task));
+        }
+        manager_->wakeIdleWorkersUnderLock(localTasks_.size());
+        localTasks_.clear();
+    }
+
+    /**
+   * Main loop for work-stealing mode and lock-free queues, entered and left
+   * holding manager_->mutex_.  Tasks are found and run without the manager
+   * lock; mutex_ is only taken to pull from a locked shared queue, to park,
+   * and to retire.
+   */
+    void runUnlocked()
+    {
+        victimSeed_ = reinterpret_cast<uintptr_t>(this) | 1;
+        manager_->mutex_.unlock();
+
+        for (;;)
+        {
+            ThreadManager::Task *task = nullptr;
+
+            if (manager_->workerCount_ <= manager_->workerMaxCount_)
+            {
+                task = findTask(false);
+            }
+
+            if (!task)
+            {
+                // Park: recheck every queue under mutex_ after announcing ourselves idle,
+                // producers read idleCount_ after publishing a task so no wakeup is lost.
+                manager_->mutex_.lock();
+                bool active = isActive();
+                while (active && !(task = findTask(true)))
+                {
+                    manager_->idleCount_++;
+                    if (manager_->pendingCount_ == 0)
+                    {
+                        manager_->parkUnderLock(this);
+                        manager_->idleCount_--;
+                    }
+                    else
+                    {
+                        // a task is in flight between two queues, let its owner finish
+                        manager_->idleCount_--;
+                        manager_->mutex_.unlock();
+                        std::this_thread::yield();
+                        manager_->mutex_.lock();
+                    }
+                    active = isActive();
+                }
+                if (!active)
+                {
+                    // retire holding the lock, the final accounting in run() must
+                    // happen before any peer evaluates isActive() again
+                    flushLocalUnderLock();
+                    break;
+                }
+                manager_->notifyAddWaiters(true);
+                manager_->mutex_.unlock();
+            }
+            else
+            {
+                manager_->notifyAddWaiters(false);
+            }
+
+            // the producers may have seen this worker idle while it woke up
+            manager_->checkBacklog();
+
+            runFound(task);
+        }
+    }
+
+    /**
+   * Runs or expires a task returned by findTask(), without holding mutex_.
+   */
+    void runFound(ThreadManager::Task *task)
+    {
+        const ThreadManager::Task::STATE state = admit(task);
+        if (!manager_->claimDequeued(task, state))
+        {
+            return;
+        }
+
+        if (state == ThreadManager::Task::EXECUTING)
+        {
+            execute(task);
+            manager_->recycleTask(task);
+        }
+        else
+        {
+            // The only other state the task could have been in is TIMEDOUT (see above)
+            manager_->expireTasks(&task, 1);
+        }
+    }
+
+public:
+    /**
+   * Helps from inside a task, see ThreadManager::runPendingTask(): finds and
+   * runs one task the way runUnlocked() does, nested in the running one.
+   * \returns false if no task was found
+   */
+    bool runOne()
+    {
+        ThreadManager::Task *task = findTask(false);
+        if (!task)
+        {
+            return false;
+        }
+        manager_->notifyAddWaiters(false);
+        runFound(task);
+        return true;
+    }
+
+    /**
+   * Worker工作者的入口
+   * Worker entry point
+   *
+   * As long as worker thread is running, pull tasks off the task queue and
+   * execute.
+   */
+    void run() override
+    {
+        Guard g(manager_->mutex_);
+
+        /**
+     * This method has three parts; one is to check for and account for
+     * admitting a task which happens under a lock.  Then the lock is released
+     * and the task itself is executed.  Finally we do some accounting
+     * under lock again when the task completes.
+     */
+
+        /**
+     * Admitting
+     */
+
+        /**
+     * Increment worker semaphore and notify manager if worker count reached
+     * desired max
+     */
+        bool active = manager_->workerCount_ < manager_->workerMaxCount_;
+        if (active)
+        {
+            if (++manager_->workerCount_ == manager_->workerMaxCount_)
+            {
+                // 通知线程管理器，当前worker线程数量已改变
+                manager_->workerMonitor_.notify();
+            }
+        }
+
+        currentWorker = this;
+
+        if (active && manager_->unlockedDequeue())
+        {
+            runUnlocked();
+            active = false;
+        }
+
+        while (active)
+        {
+            /**
+       * While holding manager monitor block for non-empty task queue (Also
+       * check that the thread hasn't been requested to stop). Once the queue
+       * is non-empty, dequeue a task, release monitor, and execute. If the
+       * worker max count has been decremented such that we exceed it, mark
+       * ourself inactive, decrement the worker count and notify the manager
+       * (technically we're notifying the next blocked thread but eventually
+       * the manager will see it.
+       */
+            active = isActive();
+            manager_->promoteDueTimers(true);
+
+            while (active && manager_->tasks_->empty())
+            {
+                manager_->idleCount_++;
+                manager_->parkUnderLock(this);
+                active = isActive();
+                manager_->idleCount_--;
+                manager_->promoteDueTimers(true);
+            }
+
+            if (active)
+            {
+                takeBatchUnderLock();
+                // the producers may have seen this worker idle while it woke up
+                manager_->checkBacklog();
+            }
+
+            /**
+       * Execution - not holding a lock
+       */
+            if (!batch_.empty())
+            {
+                // Release the lock so we can run the tasks without blocking the thread manager
+                manager_->mutex_.unlock();
+
+                const auto now = std::chrono::steady_clock::now();
+                for (ThreadManager::Task *&task : batch_)
+                {
+                    // task是否超时
+                    const ThreadManager::Task::STATE state = admit(task, now);
+                    if (!manager_->claimDequeued(task, state))
+                    {
+                        task = nullptr;
+                    }
+                    else if (state == ThreadManager::Task::EXECUTING)
+                    {
+                        execute(task);
+                    }
+                    else
+                    {
+                        // The only other state the task could have been in is TIMEDOUT (see above)
+                        expired_.push_back(task);
+                        task = nullptr;
+                    }
+                }
+
+                if (!expired_.empty())
+                {
+                    // one expire callback for the whole batch, without the lock
+                    manager_->expireTasks(expired_.data(), expired_.size());
+                    expired_.clear();
+                }
+
+                for (ThreadManager::Task *task : batch_)
+                {
+                    if (task)
+                    {
+                        manager_->recycleTask(task);
+                    }
+                }
+                batch_.clear();
+
+                // Re-acquire the lock to proceed in the thread manager
+                manager_->mutex_.lock();
+            }
+        }
+
+        /**
+     * 回收worker的线程
+     *
+     * Final accounting for the worker thread that is done working
+     */
+        manager_->taskPool_.flush(taskCache_);
+        currentWorker = nullptr;
+
+        state_ = STOPPED;
+        manager_->deadWorkers_.push_back(slot_);
+        manager_->publishWorkersUnderLock();
+        manager_->retiredCounters_.merge(counters_);
+        if (--manager_->workerCount_ == manager_->workerMaxCount_)
+        {
+            manager_->workerMonitor_.notify();
+        }
+        // the retiring worker may have been the one watching the timers
+        manager_->watchTimersUnderLock();
+        if (manager_->elasticMax_ > 0)
+        {
+            // nobody waits on an elastic retirement, the scaler joins the thread
+            manager_->requestScale();
+        }
+    }
+
+private:
+    /**
+   * 每次从共享注入队列批量转移到本地队列的最大任务数
+   */
+    static const size_t kInjectBatchMax = 32;
+
+    ThreadManager::Impl *manager_;
+    friend class ThreadManager::Impl;
+    STATE state_;
+
+    /**
+   * 在manager_->workers_中的槽位号
+   */
+    size_t slot_;
+
+    /**
+   * 工作窃取模式下的本地任务队列，本线程从尾部取，窃取者从头部取
+   */
+    Mutex localMutex_;
+    std::deque<ThreadManager::Task *> localTasks_;
+
+    /**
+   * 线程绑定的NUMA节点（-1表示未绑定），启动前设置；
+   * localClosed_表示本地队列已归还、不能再接收任务，由localMutex_保护
+   */
+    int node_;
+    bool localClosed_;
+
+    /**
+   * 本线程归还的空闲任务对象
+   */
+    TaskCache taskCache_;
+    uintptr_t victimSeed_;
+
+    /**
+   * 统计计数器
+   */
+    WorkerCounters counters_;
+
+    /**
+   * 批量获取的任务及其中过期的任务，仅在本线程中使用
+   */
+    std::vector<ThreadManager::Task *> batch_;
+    std::vector<ThreadManager::Task *> expired_;
+
+    /**
+   * 停车位：本线程空闲时阻塞在parkWord_上，唤醒者递增它
+   */
+    std::atomic<uint32_t> parkWord_;
+
+    /**
+   * 停车前忙等期间为true，此时唤醒者只需递增parkWord_，无需系统调用
+   */
+    std::atomic<bool> spinning_;
+
+    /**
+   * 是否在空闲栈中，以及栈中的前后节点，由manager_->mutex_保护
+   */
+    bool parked_;
+    Worker *idlePrev_;
+    Worker *idleNext_;
+};
+
+/**
+ * Runnable handed out for an async() task that left the queues without
+ * running (expire callback, removeNextPending()).  It keeps the task alive;
+ * running it runs the task and completes the Future, dropping it unrun
+ * abandons the Future.
+ */
+class TaskRunnable : public Runnable
+{
+public:
+    explicit TaskRunnable(ThreadManager::Task *task) : task_(task) {}
+
+    ~TaskRunnable() override
+    {
+        if (!ran_)
+        {
+            task_->abandon();
+        }
+        task_->release();
+    }
+
+    void run() override
+    {
+        if (!ran_)
+        {
+            ran_ = true;
+            task_->setState(ThreadManager::Task::EXECUTING);
+            task_->run();
+        }
+    }
+
+private:
+    ThreadManager::Task *task_;
+    bool ran_ = false;
+};
+
+/**
+ * Runnable of the reaper thread, see ThreadManager::Impl::reapExpired().
+ *
+ * 过期回收线程
+ */
+class ExpiryReaper : public Runnable
+{
+public:
+    explicit ExpiryReaper(ThreadManager::Impl *manager) : manager_(manager) {}
+
+    void run() override { manager_->reapExpired(); }
+
+private:
+    ThreadManager::Impl *manager_;
+};
+
+/**
+ * 弹性线程池的伸缩线程
+ */
+class ElasticScaler : public Runnable
+{
+public:
+    explicit ElasticScaler(ThreadManager::Impl *manager) : manager_(manager) {}
+
+    void run() override { manager_->scaleWorkers(); }
+
+private:
+    ThreadManager::Impl *manager_;
+};
+
+std::shared_ptr<Runnable> ThreadManager::Task::takeRunnable()
+{
+    if (!result_)
+    {
+        return function_.toRunnable();
+    }
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    return std::make_shared<TaskRunnable>(this);
+}
+
+void ThreadManager::Task::abandon()
+{
+    result_->exception_ = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+    complete();
+}
+
+void ThreadManager::Task::release()
+{
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        owner_->freeTask(this);
+    }
+}
+
+void ThreadManager::Task::wait()
+{
+    uint32_t signal = signal_.load(std::memory_order_acquire);
+    while (signal != FUTURE_READY)
+    {
+        // announce the waiter so that complete() knows it has to wake somebody up
+        if (signal == FUTURE_PENDING && !signal_.compare_exchange_weak(signal, FUTURE_WAITED, std::memory_order_acquire))
+        {
+            continue;
+        }
+        Futex::wait(signal_, FUTURE_WAITED);
+        signal = signal_.load(std::memory_order_acquire);
+    }
+}
+
+bool ThreadManager::Task::waitFor(int64_t timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    uint32_t signal = signal_.load(std::memory_order_acquire);
+    while (signal != FUTURE_READY)
+    {
+        if (signal == FUTURE_PENDING && !signal_.compare_exchange_weak(signal, FUTURE_WAITED, std::memory_order_acquire))
+        {
+            continue;
+        }
+        auto left = deadline - std::chrono::steady_clock::now();
+        if (left <= std::chrono::steady_clock::duration::zero())
+        {
+            return false;
+        }
+        Futex::waitFor(signal_, FUTURE_WAITED, left);
+        signal = signal_.load(std::memory_order_acquire);
+    }
+    return true;
+}
+
+void ThreadManager::Task::complete()
+{
+    // close the continuation slot first: once a waiter sees the result, then()
+    // runs the continuation on the calling thread
+    ThreadManager::Task *next = continuation_.exchange(this, std::memory_order_acq_rel);
+
+    // no system call unless a thread announced itself in wait()
+    if (signal_.exchange(FUTURE_READY, std::memory_order_acq_rel) == FUTURE_WAITED)
+    {
+        Futex::wakeAll(signal_);
+    }
+
+    if (next)
+    {
+        next->runContinuation();
+    }
+}
+
+void ThreadManager::Task::attach(ThreadManager::Task *continuation)
+{
+    ThreadManager::Task *expected = nullptr;
+    if (!continuation_.compare_exchange_strong(expected, continuation, std::memory_order_acq_rel))
+    {
+        // already completed: continuation_ holds this
+        continuation->runContinuation();
+    }
+}
+
+void ThreadManager::Task::runContinuation()
+{
+    run();
+    // the reference held on behalf of the antecedent
+    release();
+}
+
+ThreadManager::Task *ThreadManager::Task::newContinuation()
+{
+    return owner_->acquireTask();
+}
+
+/**
+ * 增加工作线程数量（增加线程池中线程数）
+*/
+void ThreadManager::Impl::addWorker(size_t value)
+{
+    std::vector<shared_ptr<Thread>> newThreads;
+    newThreads.reserve(value);
+    // 创建worker，并把worker关联到thread对象
+    for (size_t ix = 0; ix < value; ix++)
+    {
+        shared_ptr<ThreadManager::Worker> worker = std::make_shared<ThreadManager::Worker>(this);
+        shared_ptr<Thread> thread = threadFactory_->newThread(worker);
+        worker->node_ = thread->numaNode();
+        newThreads.push_back(thread);
+    }
+
+    {
+        Guard g(mutex_);
+        workerMaxCount_ += value;
+        for (const auto &newThread : newThreads)
+        {
+            shared_ptr<ThreadManager::Worker> worker = dynamic_pointer_cast<ThreadManager::Worker, Runnable>(newThread->runnable());
+            worker->state_ = ThreadManager::Worker::STARTING;
+            if (freeSlots_.empty())
+            {
+                worker->slot_ = workers_.size();
+                workers_.push_back(newThread);
+            }
+            else
+            {
+                worker->slot_ = freeSlots_.back();
+                freeSlots_.pop_back();
+                workers_[worker->slot_] = newThread;
+            }
+        }
+    }
+
+    // Start the threads without mutex_ and without a round trip to each of
+    // them: add() callers are not held up by thread creation, and the new
+    // workers block on mutex_ in run() until the barrier below releases it.
+    size_t started = 0;
+    try
+    {
+        for (; started < newThreads.size(); started++)
+        {
+            // 启动worker线程
+            newThreads[started]->start(false);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        printf("[ERROR] ThreadManager::addWorker failed to start a thread: %s", e.what());
+    }
+
+    Guard g(mutex_);
+    if (started < newThreads.size())
+    {
+        // give back the slots of the threads that do not exist
+        workerMaxCount_ -= newThreads.size() - started;
+        for (size_t ix = started; ix < newThreads.size(); ix++)
+        {
+            const size_t slot = dynamic_pointer_cast<ThreadManager::Worker, Runnable>(newThreads[ix]->runnable())->slot_;
+            workers_[slot].reset();
+            freeSlots_.push_back(slot);
+        }
+    }
+
+    publishWorkersUnderLock();
+
+    // 等待全部工作线程进入状态（执行run函数）
+    while (workerCount_ != workerMaxCount_)
+    {
+        workerMonitor_.wait();
+    }
+
+    if (elasticMax_ > 0 && state_ == ThreadManager::STARTED)
+    {
+        // the scaler starts once the initial workers exist, or applies its bounds
+        requestScale();
+    }
+
+    if (started < newThreads.size())
+    {
+        throw std::exception();
+    }
+}
+
+ThreadManager::Stats ThreadManager::Impl::stats() const
+{
+    ThreadManager::Stats stats;
+    stats.workerCount = workerCount_;
+    stats.idleWorkerCount = idleCount_;
+    stats.pendingTaskCount = pendingCount_;
+    stats.pendingTaskCountMax = pendingTaskCountMax_;
+    stats.expiredTaskCount = expiredCount_;
+    stats.executedTaskCount = 0;
+    stats.stealCount = 0;
+    stats.parkCount = 0;
+    stats.blockingWorkerCount = 0;
+    stats.blockingIdleWorkerCount = 0;
+    stats.blockingPendingTaskCount = 0;
+    stats.blockingPendingTaskCountMax = 0;
+    addCountersTo(stats);
+
+    if (blocking_)
+    {
+        stats.blockingWorkerCount = blocking_->workerCount_;
+        stats.blockingIdleWorkerCount = blocking_->idleCount_;
+        stats.blockingPendingTaskCount = blocking_->pendingCount_;
+        stats.blockingPendingTaskCountMax = blocking_->pendingTaskCountMax_;
+        stats.expiredTaskCount += blocking_->expiredCount_;
+        blocking_->addCountersTo(stats);
+    }
+    return stats;
+}
+
+void ThreadManager::Impl::addCountersTo(ThreadManager::Stats &stats) const
+{
+    retiredCounters_.addTo(stats);
+    shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+    for (size_t ix = 0; workers && ix < workers->size(); ix++)
+    {
+        (*workers)[ix]->counters_.addTo(stats);
+    }
+}
+
+void ThreadManager::Impl::publishWorkersUnderLock()
+{
+    auto workers = std::make_shared<WorkerList>();
+    workers->reserve(workers_.size());
+    std::set<int> nodes;
+    for (const auto &thread : workers_)
+    {
+        if (!thread)
+        {
+            continue;
+        }
+        shared_ptr<ThreadManager::Worker> worker = dynamic_pointer_cast<ThreadManager::Worker, Runnable>(thread->runnable());
+        if (worker->state_ != ThreadManager::Worker::STOPPED)
+        {
+            workers->push_back(worker);
+            nodes.insert(worker->node_);
+        }
+    }
+    std::atomic_store(&stealableWorkers_, shared_ptr<const WorkerList>(workers));
+    // locality only pays off once workers are bound to at least two nodes
+    nodes.erase(-1);
+    numaLocal_ = nodes.size() > 1;
+}
+
+void ThreadManager::Impl::start()
+{
+    {
+        Guard g(mutex_);
+        if (state_ == ThreadManager::STOPPED)
+        {
+            return;
+        }
+
+        if (state_ == ThreadManager::UNINITIALIZED)
+        {
+            if (!threadFactory_)
+            {
+                throw std::exception();
+            }
+            state_ = ThreadManager::STARTED;
+            monitor_.notifyAll();
+        }
+
+        while (state_ == STARTING)
+        {
+            monitor_.wait();
+        }
+    }
+
+    if (blocking_)
+    {
+        blocking_->start();
+    }
+}
+
+std::vector<shared_ptr<Runnable>> ThreadManager::Impl::stop(ThreadManager::STOP_MODE mode, int64_t deadline)
+{
+    const ThreadManager::Task::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline);
+
+    // no worker may be added behind the back of the final removeWorkersUnderLock()
+    stopScaler();
+
+    bool doStop = false;
+    std::vector<ThreadManager::Task *> leftover;
+    shared_ptr<const ExpireCallbacks> callbacks = std::atomic_load(&expireCallbacks_);
+    {
+        Guard g(mutex_);
+
+        if (state_ != ThreadManager::STOPPING && state_ != ThreadManager::JOINING && state_ != ThreadManager::STOPPED)
+        {
+            doStop = true;
+            state_ = ThreadManager::JOINING;
+            // add() calls blocked on a full queue give up, see reservePendingUnderLock()
+            maxMonitor_.notifyAll();
+        }
+
+        if (doStop)
+        {
+            const ThreadManager::Task::STATE claim = callbacks ? ThreadManager::Task::TIMEDOUT : ThreadManager::Task::EXECUTING;
+            if (mode == ThreadManager::ABORT)
+            {
+                takePendingUnderLock(claim, leftover);
+            }
+            else if (mode == ThreadManager::DRAIN_UNTIL)
+            {
+                // the workers drain the queues and retire once they are empty, the
+                // last one out notifies workerMonitor_
+                workerMaxCount_ = 0;
+                wakeIdleWorkersUnderLock(idleCount_, true);
+                while (workerCount_ != 0 && workerMonitor_.waitForTime(until) != THRIFT_ETIMEDOUT)
+                {
+                }
+                takePendingUnderLock(claim, leftover);
+            }
+            removeWorkersUnderLock(workerMaxCount_);
+
+            // timers that did not come due are dropped, cancelled ones were already
+            for (const Timer &timer : timers_)
+            {
+                if (claimDequeued(timer.task, ThreadManager::Task::TIMEDOUT))
+                {
+                    recycleTask(timer.task);
+                }
+            }
+            timers_.clear();
+            nextTimer_ = kNoTimer;
+        }
+
+        state_ = ThreadManager::STOPPED;
+    }
+
+    if (doStop)
+    {
+        // the reaper takes mutex_ to expire tasks
+        stopReaper();
+    }
+
+    std::vector<shared_ptr<Runnable>> runnables;
+    if (callbacks && !leftover.empty())
+    {
+        // one batch, as if they had all expired now
+        expireTasks(leftover.data(), leftover.size());
+    }
+    else
+    {
+        runnables.reserve(leftover.size());
+        for (ThreadManager::Task *task : leftover)
+        {
+            runnables.push_back(task->takeRunnable());
+            recycleTask(task);
+        }
+    }
+
+    // after the CPU workers, which may still hand blocking tasks over
+    if (blocking_)
+    {
+        const int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count();
+        std::vector<shared_ptr<Runnable>> lane = blocking_->stop(mode, std::max(left, static_cast<int64_t>(0)));
+        runnables.insert(runnables.end(), lane.begin(), lane.end());
+    }
+    return runnables;
+}
+
+void ThreadManager::Impl::takePendingUnderLock(ThreadManager::Task::STATE state, std::vector<ThreadManager::Task *> &tasks)
+{
+    std::vector<ThreadManager::Task *> taken;
+    ThreadManager::Task *task = nullptr;
+    while (tasks_->pop(task))
+    {
+        taken.push_back(task);
+    }
+    if (workStealing_)
+    {
+        shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+        for (size_t ix = 0; workers && ix < workers->size(); ix++)
+        {
+            ThreadManager::Worker *worker = (*workers)[ix].get();
+            Guard lg(worker->localMutex_);
+            taken.insert(taken.end(), worker->localTasks_.begin(), worker->localTasks_.end());
+            worker->localTasks_.clear();
+        }
+    }
+
+    pendingCount_ -= taken.size();
+    for (ThreadManager::Task *queued : taken)
+    {
+        // tombstones are recycled by claimDequeued()
+        if (claimDequeued(queued, state))
+        {
+            tasks.push_back(queued);
+        }
+    }
+}
+
+void ThreadManager::Impl::removeWorker(size_t value)
+{
+    Guard g(mutex_);
+    removeWorkersUnderLock(value);
+}
+
+void ThreadManager::Impl::removeWorkersUnderLock(size_t value)
+{
+    if (value > workerMaxCount_)
+    {
+        throw std::exception();
+    }
+
+    workerMaxCount_ -= value;
+
+    // Wake up to value idle workers so they can terminate, the coldest ones
+    // first; busy workers notice the new limit once their task completes.
+    wakeIdleWorkersUnderLock(value, true);
+
+    // 等待工作线程减少到workerMaxCount_个数
+    while (workerCount_ != workerMaxCount_)
+    {
+        workerMonitor_.wait();
+    }
+
+    reapDeadWorkersUnderLock();
+}
+
+void ThreadManager::Impl::reapDeadWorkersUnderLock()
+{
+    /**
+   * 回收死亡工作线程的槽位，并清空deadWorkers_
+  */
+    for (size_t slot : deadWorkers_)
+    {
+        // when used with a joinable thread factory, we join the threads as we remove them
+        if (!threadFactory_->isDetached())
+        {
+            workers_[slot]->join();
+        }
+
+        workers_[slot].reset();
+        freeSlots_.push_back(slot);
+    }
+
+    deadWorkers_.clear();
+}
+
+bool ThreadManager::Impl::tryReservePending()
+{
+    return reservePending(1) == 1;
+}
+
+bool ThreadManager::Impl::tryReserveUnderLock(ThreadManager::Task *task)
+{
+    if (fairTasks_ && fairTasks_->full(task))
+    {
+        return false;
+    }
+    return tryReservePending();
+}
+
+size_t ThreadManager::Impl::reservePending(size_t count)
+{
+    size_t pending = pendingCount_;
+    size_t reserved;
+    do
+    {
+        const size_t max = pendingTaskCountMax_;
+        if (max > 0 && pending >= max)
+        {
+            return 0;
+        }
+        reserved = max > 0 ? std::min(count, max - pending) : count;
+    } while (!pendingCount_.compare_exchange_weak(pending, pending + reserved));
+    return reserved;
+}
+
+void ThreadManager::Impl::releasePending(bool locked)
+{
+    --pendingCount_;
+    notifyAddWaiters(locked);
+}
+
+void ThreadManager::Impl::notifyAddWaiters(bool locked)
+{
+    /* If we have a pending task max and we just dropped below it, wakeup any
+    thread that might be blocked on add. */
+    if ((pendingTaskCountMax_ != 0 || fairTasks_) && maxWaiters_ > 0)
+    {
+        // with fair queues waiters may wait on different tenants, the one
+        // woken up would not necessarily be the one the freed slot is for
+        if (locked)
+        {
+            fairTasks_ ? maxMonitor_.notifyAll() : maxMonitor_.notify();
+        }
+        else
+        {
+            Guard g(mutex_);
+            fairTasks_ ? maxMonitor_.notifyAll() : maxMonitor_.notify();
+        }
+    }
+}
+
+TaskHandle ThreadManager::Impl::submit(TaskFunction &&value,
+                                       ThreadManager::SATURATION policy,
+                                       int64_t timeout,
+                                       int64_t expiration)
+{
+    ThreadManager::Task *task = newTask(std::move(value), expiration);
+    // taken before the push, once queued the task may run and be reused
+    const TaskHandle handle(task, task->getGeneration());
+    if (!enqueueTask(task, timeout, policy) && policy == ThreadManager::REJECT)
+    {
+        return TaskHandle();
+    }
+    return handle;
+}
+
+TaskHandle ThreadManager::Impl::submitWithPriority(TaskFunction &&value,
+                                                   ThreadManager::PRIORITY priority,
+                                                   ThreadManager::SATURATION policy,
+                                                   int64_t timeout,
+                                                   int64_t expiration)
+{
+    ThreadManager::Task *task = newTask(std::move(value), expiration);
+    task->priority_ = priority;
+    const TaskHandle handle(task, task->getGeneration());
+    if (!enqueueTask(task, timeout, policy) && policy == ThreadManager::REJECT)
+    {
+        return TaskHandle();
+    }
+    return handle;
+}
+
+TaskHandle ThreadManager::Impl::submitWithTenant(TaskFunction &&value,
+                                                 uint32_t tenant,
+                                                 ThreadManager::SATURATION policy,
+                                                 int64_t timeout,
+                                                 int64_t expiration)
+{
+    ThreadManager::Task *task = newTask(std::move(value), expiration);
+    task->tenant_ = tenant;
+    const TaskHandle handle(task, task->getGeneration());
+    if (!enqueueTask(task, timeout, policy) && policy == ThreadManager::REJECT)
+    {
+        return TaskHandle();
+    }
+    return handle;
+}
+
+void ThreadManager::Impl::tenantShare(uint32_t tenant, uint32_t weight, size_t pendingTaskCountMax)
+{
+    Guard g(mutex_);
+    if (!fairTasks_ || (tenant == 0 && pendingTaskCountMax != 0))
+    {
+        throw std::exception(
+            "ThreadManager::Impl::tenantShare no fair queues "
+            "or limit on tenant 0");
+    }
+    fairTasks_->share(tenant, weight, pendingTaskCountMax);
+}
+
+size_t ThreadManager::Impl::tenantPendingTaskCount(uint32_t tenant) const
+{
+    Guard g(mutex_);
+    if (fairTasks_)
+    {
+        return fairTasks_->size(tenant);
+    }
+    return tenant == 0 ? pendingCount_.load() : 0;
+}
+
+size_t ThreadManager::Impl::pendingTaskCount(ThreadManager::PRIORITY priority) const
+{
+    Guard g(mutex_);
+    if (priorityTasks_)
+    {
+        return priorityTasks_->size(priority);
+    }
+    return priority == ThreadManager::NORMAL ? pendingCount_.load() : 0;
+}
+
+bool ThreadManager::Impl::enqueueTask(ThreadManager::Task *task, int64_t timeout, ThreadManager::SATURATION policy)
+{
+    if (recordLatencies_.load(std::memory_order_relaxed))
+    {
+        task->enqueueTime_ = std::chrono::steady_clock::now();
+    }
+
+    if (!task->hasExpireTime())
+    {
+        const bool queued = queueTask(task, timeout, policy);
+        checkBacklog();
+        if (!queued)
+        {
+            refuseTask(task, policy);
+        }
+        return queued;
+    }
+
+    const Expiry expiry = expiryOf(task);
+    if (!queueTask(task, timeout, policy))
+    {
+        checkBacklog();
+        refuseTask(task, policy);
+        return false;
+    }
+    watchExpiries(&expiry, 1);
+    checkBacklog();
+    return true;
+}
+
+bool ThreadManager::Impl::queueTask(ThreadManager::Task *task, int64_t timeout, ThreadManager::SATURATION policy)
+{
+    try
+    {
+        ThreadManager::Worker *worker = localWorker();
+        if (workStealing_ && worker)
+        {
+            return addLocal(worker, task, policy);
+        }
+
+        if (workStealing_ && numaLocal_ && queueOnNode(task))
+        {
+            return true;
+        }
+
+        if (tasks_->isLockFree())
+        {
+            // Fast path: a free slot means the ring has room, only take mutex_
+            // when the queue is full or a worker must be woken up.
+            if (tryReservePending())
+            {
+                // checked after the reservation: a stop() that did not see the
+                // slot is seen here, one that did keeps workers until it drains
+                if (state_ != ThreadManager::STARTED)
+                {
+                    releasePending(false);
+                    throw std::exception(
+                        "ThreadManager::Impl::add ThreadManager "
+                        "not started");
+                }
+                pushReserved(task);
+                notifyIdleWorker();
+                return true;
+            }
+        }
+
+        // declared first: calls back after the Guard released mutex_
+        ExpiredTasks expired(this);
+        Guard g(mutex_, timeout);
+
+        if (!g)
+        {
+            throw std::exception();
+        }
+
+        if (state_ != ThreadManager::STARTED)
+        {
+            throw std::exception(
+                "ThreadManager::Impl::add ThreadManager "
+                "not started");
+        }
+
+        if (!reservePendingUnderLock(task, policy, timeout, expired))
+        {
+            return false;
+        }
+
+        pushReserved(task);
+
+        // If idle thread is available notify it, otherwise all worker threads are
+        // running and will get around to this task in time.
+        if (idleCount_ > 0)
+        {
+            wakeIdleWorkersUnderLock(1);
+        }
+        return true;
+    }
+    catch (...)
+    {
+        // the task never made it into a queue
+        recycleTask(task);
+        throw;
+    }
+}
+
+bool ThreadManager::Impl::reservePendingUnderLock(ThreadManager::Task *task,
+                                                  ThreadManager::SATURATION policy,
+                                                  int64_t timeout,
+                                                  ExpiredTasks &expired)
+{
+    // if we're at a limit, remove an expired task to see if the limit clears;
+    // this only scans the queue when the expiry index says it can help
+    if (tryReserveUnderLock(task))
+    {
+        return true;
+    }
+    removeExpired(true, expired);
+    if (tryReserveUnderLock(task))
+    {
+        return true;
+    }
+
+    if (policy == ThreadManager::REJECT || policy == ThreadManager::CALLER_RUNS)
+    {
+        return false;
+    }
+    if (policy == ThreadManager::DROP_OLDEST)
+    {
+        ThreadManager::Task *oldest = nullptr;
+        if (fairTasks_ && fairTasks_->full(task))
+        {
+            // the tenant is at its own limit: its oldest task gives up its
+            // slot, in the tenant's queue and in the manager's count
+            if (fairTasks_->evict(task->getTenant(), oldest))
+            {
+                if (claimDequeued(oldest, ThreadManager::Task::TIMEDOUT))
+                {
+                    expired.push(oldest);
+                }
+                return true;
+            }
+        }
+        else if (evictOldestUnderLock(expired))
+        {
+            return true;
+        }
+    }
+
+    if (canSleep() && timeout >= 0)
+    { // 带添加等待超时时间的task需先判断是否能等待，否则在等待时可能造成死锁
+        maxWaiters_++;
+        CONCURRENCY_TRACE(ADD_WAIT, nullptr, 0);
+        try
+        {
+            while (!tryReserveUnderLock(task))
+            {
+                // This is thread safe because the mutex is shared between monitors.
+                maxMonitor_.wait(timeout);
+                if (state_ != ThreadManager::STARTED)
+                {
+                    // woken by stop(), the slots it freed are not for new tasks
+                    throw std::exception(
+                        "ThreadManager::Impl::add ThreadManager "
+                        "stopped");
+                }
+            }
+        }
+        catch (...)
+        {
+            maxWaiters_--;
+            CONCURRENCY_TRACE(ADD_RESUME, nullptr, 0);
+            throw;
+        }
+        maxWaiters_--;
+        CONCURRENCY_TRACE(ADD_RESUME, nullptr, 0);
+        return true;
+    }
+    throw std::exception();
+}
+
+bool ThreadManager::Impl::evictOldestUnderLock(ExpiredTasks &expired)
+{
+    ThreadManager::Task *task = nullptr;
+    if (!tasks_->evict(task) && workStealing_)
+    {
+        shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+        for (size_t ix = 0; workers && ix < workers->size() && !task; ix++)
+        {
+            ThreadManager::Worker *worker = (*workers)[ix].get();
+            Guard lg(worker->localMutex_);
+            if (!worker->localTasks_.empty())
+            {
+                task = worker->localTasks_.front();
+                worker->localTasks_.pop_front();
+            }
+        }
+    }
+    if (!task)
+    {
+        // every slot is held by a task on its way into a queue
+        return false;
+    }
+
+    // a tombstone gives its slot up all the same
+    if (claimDequeued(task, ThreadManager::Task::TIMEDOUT))
+    {
+        expired.push(task);
+    }
+    return true;
+}
+
+void ThreadManager::Impl::refuseTask(ThreadManager::Task *task, ThreadManager::SATURATION policy)
+{
+    if (policy == ThreadManager::CALLER_RUNS && task->claim(ThreadManager::Task::EXECUTING) == ThreadManager::Task::EXECUTING)
+    {
+        CONCURRENCY_TRACE(START, task, task->getGeneration());
+        try
+        {
+            task->run();
+        }
+        catch (const std::exception &e)
+        {
+            printf("[ERROR] task->run() raised an exception: %s", e.what());
+        }
+        catch (...)
+        {
+            printf("[ERROR] task->run() raised an unknown exception");
+        }
+        CONCURRENCY_TRACE(FINISH, nullptr, 0);
+    }
+    else if (task->isAsync())
+    {
+        task->abandon();
+    }
+    recycleTask(task);
+}
+
+size_t ThreadManager::Impl::enqueueBatch(ThreadManager::Task *const *tasks, size_t count, int64_t timeout)
+{
+    if (recordLatencies_.load(std::memory_order_relaxed))
+    {
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t ix = 0; ix < count; ix++)
+        {
+            tasks[ix]->enqueueTime_ = now;
+        }
+    }
+
+    size_t accepted = 0;
+    std::vector<Expiry> expiries;
+    auto collectExpiries = [&]() {
+        for (size_t ix = 0; ix < accepted; ix++)
+        {
+            if (tasks[ix]->hasExpireTime())
+            {
+                expiries.push_back(expiryOf(tasks[ix]));
+            }
+        }
+    };
+    try
+    {
+        if (state_ != ThreadManager::STARTED)
+        {
+            throw std::exception(
+                "ThreadManager::Impl::addBatch ThreadManager "
+                "not started");
+        }
+
+        ThreadManager::Worker *worker = localWorker();
+        if (workStealing_ && worker)
+        {
+            // a worker thread never blocks on a full queue
+            accepted = reservePending(count);
+            if (accepted < count)
+            {
+                ExpiredTasks expired(this);
+                Guard g(mutex_);
+                removeExpired(false, expired);
+                accepted += reservePending(count - accepted);
+            }
+
+            collectExpiries();
+            {
+                Guard g(worker->localMutex_);
+                worker->localTasks_.insert(worker->localTasks_.end(), tasks, tasks + accepted);
+            }
+
+            if (accepted > 0 && idleCount_ > 0)
+            {
+                Guard g(mutex_);
+                wakeIdleWorkersUnderLock(accepted);
+            }
+        }
+        else
+        {
+            ExpiredTasks expired(this);
+            Guard g(mutex_, timeout);
+
+            if (!g)
+            {
+                throw std::exception();
+            }
+
+            if (state_ != ThreadManager::STARTED)
+            {
+                throw std::exception(
+                    "ThreadManager::Impl::addBatch ThreadManager "
+                    "not started");
+            }
+
+            accepted = reservePending(count);
+            if (accepted < count)
+            {
+                removeExpired(false, expired);
+                accepted += reservePending(count - accepted);
+            }
+
+            if (accepted == 0 && canSleep() && timeout >= 0)
+            {
+                // wait for room for at least one task, as add() would
+                maxWaiters_++;
+                CONCURRENCY_TRACE(ADD_WAIT, nullptr, 0);
+                while (state_ == ThreadManager::STARTED && (accepted = reservePending(count)) == 0)
+                {
+                    if (maxMonitor_.waitForTimeRelative(timeout) == THRIFT_ETIMEDOUT)
+                    {
+                        break;
+                    }
+                }
+                maxWaiters_--;
+                CONCURRENCY_TRACE(ADD_RESUME, nullptr, 0);
+            }
+
+            collectExpiries();
+            for (size_t ix = 0; ix < accepted; ix++)
+            {
+                pushReserved(tasks[ix]);
+            }
+
+            wakeIdleWorkersUnderLock(accepted);
+        }
+    }
+    catch (...)
+    {
+        for (size_t ix = accepted; ix < count; ix++)
+        {
+            recycleTask(tasks[ix]);
+        }
+        throw;
+    }
+
+    for (size_t ix = accepted; ix < count; ix++)
+    {
+        recycleTask(tasks[ix]);
+    }
+    if (!expiries.empty())
+    {
+        watchExpiries(expiries.data(), expiries.size());
+    }
+    checkBacklog();
+    return accepted;
+}
+
+bool ThreadManager::Impl::addLocal(ThreadManager::Worker *worker,
+                                   ThreadManager::Task *task,
+                                   ThreadManager::SATURATION policy)
+{
+    if (state_ != ThreadManager::STARTED)
+    {
+        throw std::exception(
+            "ThreadManager::Impl::add ThreadManager "
+            "not started");
+    }
+
+    if (!tryReservePending())
+    {
+        // a worker thread never blocks on a full queue: BLOCK throws here
+        ExpiredTasks expired(this);
+        Guard g(mutex_);
+        if (!reservePendingUnderLock(task, policy, 0, expired))
+        {
+            return false;
+        }
+    }
+
+    {
+        Guard g(worker->localMutex_);
+        CONCURRENCY_TRACE(ENQUEUE, task, task->getGeneration());
+        worker->localTasks_.push_back(task);
+    }
+
+    notifyIdleWorker();
+    return true;
+}
+
+bool ThreadManager::Impl::queueOnNode(ThreadManager::Task *task)
+{
+    const int node = CpuTopology::currentNode();
+    if (node < 0 || !tryReservePending())
+    {
+        // a full queue is left to the shared path, which knows how to wait
+        return false;
+    }
+    if (state_ != ThreadManager::STARTED)
+    {
+        // checked after the reservation, see queueTask(); the shared path throws
+        releasePending(false);
+        return false;
+    }
+
+    auto pushTo = [task](ThreadManager::Worker *worker) {
+        Guard g(worker->localMutex_);
+        if (worker->localClosed_)
+        {
+            return false;
+        }
+        CONCURRENCY_TRACE(ENQUEUE, task, task->getGeneration());
+        worker->localTasks_.push_back(task);
+        return true;
+    };
+
+    if (idleCount_ > 0)
+    {
+        // an idle worker of the node takes the task right away
+        Guard g(mutex_);
+        for (ThreadManager::Worker *worker = idleHead_; worker; worker = worker->idleNext_)
+        {
+            if (worker->node_ == node && pushTo(worker))
+            {
+                wakeWorkerUnderLock(worker);
+                return true;
+            }
+        }
+    }
+
+    // every worker of the node is busy: queue behind one of them, an idle
+    // worker of another node spills over by stealing it
+    shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+    const size_t count = workers ? workers->size() : 0;
+    const size_t offset = nodeCursor_++;
+    bool queued = false;
+    for (size_t ix = 0; ix < count && !queued; ix++)
+    {
+        ThreadManager::Worker *worker = (*workers)[(offset + ix) % count].get();
+        queued = worker->node_ == node && pushTo(worker);
+    }
+    if (!queued)
+    {
+        // no worker of the node took it: the shared queue is pushed under mutex_
+        releasePending(false);
+        return false;
+    }
+    notifyIdleWorker();
+    return true;
+}
+
+bool ThreadManager::Impl::runPendingTask()
+{
+    ThreadManager::Worker *worker = localWorker();
+    return worker && worker->runOne();
+}
+
+ThreadManager::Worker *ThreadManager::Impl::localWorker() const
+{
+    ThreadManager::Worker *worker = currentWorker;
+    return (worker && worker->manager_ == this) ? worker : nullptr;
+}
+
+TaskCache *ThreadManager::Impl::workerCache() const
+{
+    ThreadManager::Worker *worker = localWorker();
+    return worker ? &worker->taskCache_ : nullptr;
+}
+
+ThreadManager::Task *ThreadManager::Impl::acquireTask()
+{
+    ThreadManager::Task *task = taskPool_.acquire(workerCache());
+    task->owner_ = this;
+    return task;
+}
+
+ThreadManager::Task *ThreadManager::Impl::newTask(TaskFunction &&value, int64_t expiration)
+{
+    ThreadManager::Task *task = acquireTask();
+    task->reset(std::move(value), expiration);
+    return task;
+}
+
+void ThreadManager::Impl::recycleTask(ThreadManager::Task *task)
+{
+    if (task->period_ != 0 && task->getState() == ThreadManager::Task::COMPLETE && reschedule(task))
+    {
+        return;
+    }
+
+    if (task->isAsync())
+    {
+        task->release();
+    }
+    else
+    {
+        freeTask(task);
+    }
+}
+
+void ThreadManager::Impl::freeTask(ThreadManager::Task *task)
+{
+    taskPool_.release(task, workerCache());
+}
+
+void ThreadManager::Impl::expireTasks(ThreadManager::Task *const *tasks, size_t count)
+{
+    expiredCount_ += count;
+
+    shared_ptr<const ExpireCallbacks> callbacks = std::atomic_load(&expireCallbacks_);
+    std::vector<shared_ptr<Runnable>> runnables;
+    for (size_t ix = 0; ix < count; ix++)
+    {
+        ThreadManager::Task *task = tasks[ix];
+        CONCURRENCY_TRACE(EXPIRE, task, task->getGeneration());
+        if (callbacks)
+        {
+            runnables.push_back(task->takeRunnable());
+        }
+        else if (task->isAsync())
+        {
+            task->abandon();
+        }
+        recycleTask(task);
+    }
+
+    if (callbacks)
+    {
+        fireExpireCallbacks(*callbacks, runnables);
+    }
+}
+
+void ThreadManager::Impl::fireExpireCallbacks(const ExpireCallbacks &callbacks, const std::vector<shared_ptr<Runnable>> &runnables)
+{
+    auto call = [](const std::function<void()> &callback) {
+        try
+        {
+            callback();
+        }
+        catch (const std::exception &e)
+        {
+            printf("[ERROR] expire callback raised an exception: %s", e.what());
+        }
+        catch (...)
+        {
+            printf("[ERROR] expire callback raised an unknown exception");
+        }
+    };
+
+    if (callbacks.batch)
+    {
+        call([&callbacks, &runnables]() { callbacks.batch(runnables); });
+        return;
+    }
+    for (const auto &runnable : runnables)
     {
-        Guard g(manager_->mutex_);
+        // one failing call does not cost the other tasks their callback
+        call([&callbacks, &runnable]() { callbacks.single(runnable); });
+    }
+}
 
-        /**
-     * This method has three parts; one is to check for and account for
-     * admitting a task which happens under a lock.  Then the lock is released
-     * and the task itself is executed.  Finally we do some accounting
-     * under lock again when the task completes.
-     */
+void ThreadManager::Impl::pushReserved(ThreadManager::Task *task)
+{
+    CONCURRENCY_TRACE(ENQUEUE, task, task->getGeneration());
+    while (!tasks_->push(std::move(task)))
+    {
+        // a lock-free ring reports full until a concurrent pop has released
+        // the cell, the reservation guarantees that room is on its way
+        std::this_thread::yield();
+    }
+}
 
-        /**
-     * Admitting
-     */
+void ThreadManager::Impl::notifyIdleWorker()
+{
+    // pendingCount_ was bumped before the push, a parking worker rechecks
+    // the queues after incrementing idleCount_ so either side sees the other.
+    if (idleCount_ > 0)
+    {
+        Guard g(mutex_);
+        wakeIdleWorkersUnderLock(1);
+    }
+}
 
-        /**
-     * Increment worker semaphore and notify manager if worker count reached
-     * desired max
-     */
-        bool active = manager_->workerCount_ < manager_->workerMaxCount_;
-        if (active)
+void ThreadManager::Impl::parkUnderLock(ThreadManager::Worker *worker)
+{
+    worker->idlePrev_ = nullptr;
+    worker->idleNext_ = idleHead_;
+    if (idleHead_)
+    {
+        idleHead_->idlePrev_ = worker;
+    }
+    else
+    {
+        idleTail_ = worker;
+    }
+    idleHead_ = worker;
+    worker->parked_ = true;
+    WorkerCounters::bump(worker->counters_.parks);
+
+    // sampled under mutex_, a wake-up after the unlock changes the word and
+    // the futex wait returns right away
+    const uint32_t word = worker->parkWord_.load();
+    bool keepAlive = elastic_.maxWorkers > 0 && workerMaxCount_ > elastic_.minWorkers;
+    bool bounded = keepAlive;
+    std::chrono::nanoseconds timeout = std::chrono::milliseconds(elastic_.keepAlive);
+    if (!timerWatcher_ && !timers_.empty())
+    {
+        // one parked worker sleeps until the next deadline, the others until woken
+        timerWatcher_ = worker;
+        const std::chrono::nanoseconds untilDue =
+            std::max(std::chrono::nanoseconds(timers_.front().due - std::chrono::steady_clock::now()), std::chrono::nanoseconds(0));
+        if (!bounded || untilDue < timeout)
         {
-            if (++manager_->workerCount_ == manager_->workerMaxCount_)
-            {
-                // 通知线程管理器，当前worker线程数量已改变
-                manager_->workerMonitor_.notify();
-            }
+            timeout = untilDue;
+            keepAlive = false;
         }
+        bounded = true;
+    }
+    const ThreadManager::IdlePolicy policy = idle_;
+    const bool hot = hotSpinners_ < policy.hotWorkers;
+    const bool spin = hot || policy.spinCount > 0 || policy.yieldCount > 0;
+    if (hot)
+    {
+        ++hotSpinners_;
+    }
+    mutex_.unlock();
+    CONCURRENCY_TRACE(PARK, nullptr, 0);
+    bool woken = true;
+    if (spin && spinUnderPark(worker, word, policy, hot))
+    {
+        // woken up, or work to look at, without sleeping
+    }
+    else if (bounded)
+    {
+        woken = Futex::waitFor(worker->parkWord_, word, timeout);
+    }
+    else
+    {
+        Futex::wait(worker->parkWord_, word);
+    }
+    CONCURRENCY_TRACE(UNPARK, nullptr, 0);
+    mutex_.lock();
+    if (hot)
+    {
+        --hotSpinners_;
+    }
 
-        while (active)
+    if (timerWatcher_ == worker)
+    {
+        timerWatcher_ = nullptr;
+    }
+
+    if (worker->parked_)
+    {
+        // spurious wake-up, a timer came due, or idle for the whole keep-alive interval
+        unlinkIdleUnderLock(worker);
+        if (!woken && keepAlive && elastic_.maxWorkers > 0 && workerMaxCount_ > elastic_.minWorkers && pendingCount_ == 0)
         {
-            /**
-       * While holding manager monitor block for non-empty task queue (Also
-       * check that the thread hasn't been requested to stop). Once the queue
-       * is non-empty, dequeue a task, release monitor, and execute. If the
-       * worker max count has been decremented such that we exceed it, mark
-       * ourself inactive, decrement the worker count and notify the manager
-       * (technically we're notifying the next blocked thread but eventually
-       * the manager will see it.
-       */
-            active = isActive();
+            // over the lowered limit, isActive() turns false and a worker retires
+            --workerMaxCount_;
+        }
+    }
+}
 
-            while (active && manager_->tasks_.empty())
+bool ThreadManager::Impl::spinUnderPark(ThreadManager::Worker *worker,
+                                        uint32_t word,
+                                        const ThreadManager::IdlePolicy &policy,
+                                        bool hot)
+{
+    const uint64_t polls = static_cast<uint64_t>(policy.spinCount) + policy.yieldCount;
+    bool done = false;
+    worker->spinning_.store(true);
+    for (uint64_t ix = 0; hot || ix < polls; ix++)
+    {
+        // a pending task may have been pushed without waking anyone up, the
+        // caller unlinks itself from the idle stack and looks for it
+        if (worker->parkWord_.load(std::memory_order_acquire) != word || pendingCount_.load(std::memory_order_relaxed) != 0)
+        {
+            done = true;
+            break;
+        }
+        if ((ix & 63) == 0)
+        {
+            const int64_t next = nextTimer_.load(std::memory_order_relaxed);
+            if (next != kNoTimer && std::chrono::steady_clock::now().time_since_epoch().count() >= next)
             {
-                manager_->idleCount_++;
-                manager_->monitor_.wait();
-                active = isActive();
-                manager_->idleCount_--;
+                done = true;
+                break;
             }
+        }
+        if (ix < policy.spinCount)
+        {
+            cpuRelax();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    // paired with wakeWorkerUnderLock(): either the waker sees the flag
+    // cleared and calls the futex, or the word read below has changed
+    worker->spinning_.store(false);
+    return done || worker->parkWord_.load() != word;
+}
 
-            shared_ptr<ThreadManager::Task> task;
-
-            if (active)
+size_t ThreadManager::Impl::wakeIdleWorkersUnderLock(size_t count, bool coldest)
+{
+    size_t woken = 0;
+    while (woken < count && idleHead_)
+    {
+        ThreadManager::Worker *worker = coldest ? idleTail_ : idleHead_;
+        if (!coldest && (hotSpinners_ > 0 || idle_.spinCount > 0 || idle_.yieldCount > 0))
+        {
+            // a polling worker takes the task without a system call, and a hot
+            // one is not necessarily the last one parked
+            for (ThreadManager::Worker *idle = idleHead_; idle; idle = idle->idleNext_)
             {
-                if (!manager_->tasks_.empty())
-                {
-                    task = manager_->tasks_.front();
-                    manager_->tasks_.pop_front();
-                    if (task->state_ == ThreadManager::Task::WAITING)
-                    {
-                        // If the state is changed to anything other than EXECUTING or TIMEDOUT here
-                        // then the execution loop needs to be changed below.
-                        task->state_ = (task->getExpireTime() && *(task->getExpireTime()) < std::chrono::steady_clock::now())
-                                           ? ThreadManager::Task::TIMEDOUT
-                                           : ThreadManager::Task::EXECUTING;
-                    }
-                }
-
-                /* If we have a pending task max and we just dropped below it, wakeup any
-            thread that might be blocked on add. */
-                if (manager_->pendingTaskCountMax_ != 0 && manager_->tasks_.size() <= manager_->pendingTaskCountMax_ - 1)
+                if (idle->spinning_.load(std::memory_order_relaxed))
                 {
-                    manager_->maxMonitor_.notify();
+                    worker = idle;
+                    break;
                 }
             }
+        }
+        wakeWorkerUnderLock(worker);
+        ++woken;
+    }
+    return woken;
+}
 
-            /**
-       * Execution - not holding a lock
-       */
-            if (task)
+void ThreadManager::Impl::wakeWorkerUnderLock(ThreadManager::Worker *worker)
+{
+    unlinkIdleUnderLock(worker);
+    worker->parkWord_.fetch_add(1);
+    if (!worker->spinning_.load())
+    {
+        // a polling worker sees the new word, no system call needed
+        Futex::wakeOne(worker->parkWord_);
+    }
+}
+
+void ThreadManager::Impl::unlinkIdleUnderLock(ThreadManager::Worker *worker)
+{
+    if (worker->idlePrev_)
+    {
+        worker->idlePrev_->idleNext_ = worker->idleNext_;
+    }
+    else
+    {
+        idleHead_ = worker->idleNext_;
+    }
+    if (worker->idleNext_)
+    {
+        worker->idleNext_->idlePrev_ = worker->idlePrev_;
+    }
+    else
+    {
+        idleTail_ = worker->idlePrev_;
+    }
+    worker->idlePrev_ = worker->idleNext_ = nullptr;
+    worker->parked_ = false;
+}
+
+namespace {
+/**
+ * removeIf() for the work-stealing local queues, which are plain std::deque.
+ */
+template <class T>
+size_t removeFromDeque(std::deque<T> &queue, const std::function<bool(const T &)> &pred, bool justOne, std::vector<T> &removed)
+{
+    size_t count = 0;
+    for (auto it = queue.begin(); it != queue.end() && !(justOne && count > 0);)
+    {
+        if (pred(*it))
+        {
+            removed.push_back(std::move(*it));
+            it = queue.erase(it);
+            ++count;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    return count;
+}
+}
+
+void ThreadManager::Impl::remove(shared_ptr<Runnable> task)
+{
+    Guard g(mutex_);
+    if (state_ != ThreadManager::STARTED)
+    {
+        throw std::exception(
+            "ThreadManager::Impl::remove ThreadManager not "
+            "started");
+    }
+
+    if (!task)
+    {
+        // async() and submit() tasks hold no Runnable, remove() never matches them
+        return;
+    }
+
+    auto matches = [&task](ThreadManager::Task *queued) { return queued->getRunnable() == task; };
+    std::vector<ThreadManager::Task *> removed;
+
+    if (tasks_->removeIf(matches, true, removed) == 0 && workStealing_)
+    {
+        shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+        for (size_t ix = 0; workers && ix < workers->size() && removed.empty(); ix++)
+        {
+            ThreadManager::Worker *worker = (*workers)[ix].get();
+            Guard lg(worker->localMutex_);
+            removeFromDeque<ThreadManager::Task *>(worker->localTasks_, matches, true, removed);
+        }
+    }
+
+    bool reserved = !removed.empty();
+    if (removed.empty())
+    {
+        // a delayed task, or a periodic one waiting for its next run
+        auto timer = std::find_if(timers_.begin(), timers_.end(), [&matches](const Timer &t) { return matches(t.task); });
+        if (timer != timers_.end())
+        {
+            removed.push_back(timer->task);
+            timers_.erase(timer);
+            std::make_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+            nextTimer_ = timers_.empty() ? kNoTimer : timers_.front().due.time_since_epoch().count();
+        }
+    }
+
+    if (!removed.empty())
+    {
+        // dropped, not run: recycleTask() does not reschedule a periodic task
+        ThreadManager::Task *found = removed.front();
+        if (claimDequeued(found, ThreadManager::Task::TIMEDOUT))
+        {
+            if (found->isAsync())
             {
-                // task是否超时
-                if (task->state_ == ThreadManager::Task::EXECUTING)
-                {
+                found->abandon();
+            }
+            recycleTask(found);
+        }
+        if (reserved)
+        {
+            releasePending(true);
+        }
+    }
+    else if (blocking_)
+    {
+        blocking_->remove(task);
+    }
+}
+
+bool ThreadManager::Impl::cancel(const TaskHandle &handle)
+{
+    ThreadManager::Task *task = handle.task_;
+    if (task && task->owner_ != this)
+    {
+        // a task of the blocking lane, whose pool it never leaves
+        return task->owner_->cancel(handle);
+    }
+    if (!task || !task->transition(handle.generation_, ThreadManager::Task::WAITING, ThreadManager::Task::DROPPING))
+    {
+        // started, ran, expired, removed or reused
+        return false;
+    }
 
-                    // Release the lock so we can run the task without blocking the thread manager
-                    manager_->mutex_.unlock();
+    if (task->isAsync())
+    {
+        task->abandon();
+    }
 
-                    try
-                    {
-                        task->run();
-                    }
-                    catch (const std::exception &e)
-                    {
-                        printf("[ERROR] task->run() raised an exception: %s", e.what());
-                    }
-                    catch (...)
-                    {
-                        printf("[ERROR] task->run() raised an unknown exception");
-                    }
+    // leave a tombstone in the queue, unless the task was dequeued meanwhile
+    ++tombstones_;
+    if (!task->transition(handle.generation_, ThreadManager::Task::DROPPING, ThreadManager::Task::DROPPED))
+    {
+        --tombstones_;
+        recycleTask(task);
+    }
+    return true;
+}
 
-                    // Re-acquire the lock to proceed in the thread manager
-                    manager_->mutex_.lock();
-                }
-                else if (manager_->expireCallback_)
+std::shared_ptr<Runnable> ThreadManager::Impl::removeNextPending()
+{
+    Guard g(mutex_);
+    if (state_ != ThreadManager::STARTED)
+    {
+        throw std::exception(
+            "ThreadManager::Impl::removeNextPending "
+            "ThreadManager not started");
+    }
+
+    for (;;)
+    {
+        ThreadManager::Task *task = nullptr;
+
+        if (!tasks_->pop(task) && workStealing_)
+        {
+            // the injection queue is empty, take the oldest task of the first busy worker
+            shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+            for (size_t ix = 0; workers && ix < workers->size() && !task; ix++)
+            {
+                ThreadManager::Worker *worker = (*workers)[ix].get();
+                Guard lg(worker->localMutex_);
+                if (!worker->localTasks_.empty())
                 {
-                    // The only other state the task could have been in is TIMEDOUT (see above)
-                    manager_->expireCallback_(task->getRunnable());
-                    manager_->expiredCount_++;
+                    task = worker->localTasks_.front();
+                    worker->localTasks_.pop_front();
                 }
             }
         }
 
-        /**
-     * 回收worker的线程
-     * 
-     * Final accounting for the worker thread that is done working
-     */
-        manager_->deadWorkers_.insert(this->thread());
-        if (--manager_->workerCount_ == manager_->workerMaxCount_)
+        if (!task)
         {
-            manager_->workerMonitor_.notify();
+            return blocking_ ? blocking_->removeNextPending() : std::shared_ptr<Runnable>();
+        }
+
+        releasePending(true);
+        if (claimDequeued(task, ThreadManager::Task::EXECUTING))
+        {
+            shared_ptr<Runnable> runnable = task->takeRunnable();
+            recycleTask(task);
+            return runnable;
         }
+        // a tombstone left by the reaper, try the next one
     }
+}
 
-private:
-    ThreadManager::Impl *manager_;
-    friend class ThreadManager::Impl;
-    STATE state_;
-};
+void ThreadManager::Impl::removeExpired(bool justOne, ExpiredTasks &expired)
+{
+    // this is always called under a lock
+    if (pendingCount_ == 0)
+    {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!expiryDue(now))
+    {
+        return;
+    }
+
+    auto isExpired = [&now](ThreadManager::Task *task) {
+        return (task->hasExpireTime() && task->isExpired(now)) || task->getState() == ThreadManager::Task::DROPPED;
+    };
+    std::vector<ThreadManager::Task *> removed;
+
+    tasks_->removeIf(isExpired, justOne, removed);
+
+    if (workStealing_ && !(justOne && !removed.empty()))
+    {
+        shared_ptr<const WorkerList> workers = std::atomic_load(&stealableWorkers_);
+        for (size_t ix = 0; workers && ix < workers->size() && !(justOne && !removed.empty()); ix++)
+        {
+            ThreadManager::Worker *worker = (*workers)[ix].get();
+            Guard lg(worker->localMutex_);
+            removeFromDeque<ThreadManager::Task *>(worker->localTasks_, isExpired, justOne, removed);
+        }
+    }
+
+    for (ThreadManager::Task *task : removed)
+    {
+        // tombstones left by the reaper or cancel() match too, they only free their slot
+        if (claimDequeued(task, ThreadManager::Task::TIMEDOUT))
+        {
+            expired.push(task);
+        }
+        releasePending(true);
+    }
+}
+
+bool ThreadManager::Impl::claimDequeued(ThreadManager::Task *task, ThreadManager::Task::STATE state)
+{
+    const ThreadManager::Task::STATE claimed = task->claim(state);
+    if (claimed == state)
+    {
+        return true;
+    }
+    if (claimed == ThreadManager::Task::DROPPED)
+    {
+        --tombstones_;
+        recycleTask(task);
+    }
+    return false;
+}
+
+TaskHandle ThreadManager::Impl::scheduleTimer(shared_ptr<Runnable> value, int64_t delay, int64_t period)
+{
+    ThreadManager::Task *task = newTask(TaskFunction(RunnableCall(std::move(value))), 0);
+    task->period_ = period;
+    task->dueTime_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(delay, static_cast<int64_t>(0)));
+    const TaskHandle handle(task, task->getGeneration());
+
+    Guard g(mutex_);
+    if (state_ != ThreadManager::STARTED)
+    {
+        recycleTask(task);
+        throw std::exception(
+            "ThreadManager::Impl::scheduleTimer ThreadManager "
+            "not started");
+    }
+    addTimerUnderLock(task);
+    return handle;
+}
 
-/**
- * 增加工作线程数量（增加线程池中线程数）
-*/
-void ThreadManager::Impl::addWorker(size_t value)
+void ThreadManager::Impl::addTimerUnderLock(ThreadManager::Task *task)
 {
-    std::set<shared_ptr<Thread>> newThreads;
-    // 创建worker，并把worker关联到thread对象
-    for (size_t ix = 0; ix < value; ix++)
+    const bool earliest = timers_.empty() || task->dueTime_ < timers_.front().due;
+    timers_.push_back(Timer{task->dueTime_, task});
+    std::push_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+    if (!earliest)
     {
-        shared_ptr<ThreadManager::Worker> worker = std::make_shared<ThreadManager::Worker>(this);
-        newThreads.insert(threadFactory_->newThread(worker));
+        return;
     }
 
-    Guard g(mutex_);
-    workerMaxCount_ += value;
-    workers_.insert(newThreads.begin(), newThreads.end());
-
-    for (const auto &newThread : newThreads)
+    nextTimer_ = task->dueTime_.time_since_epoch().count();
+    if (!(std::chrono::steady_clock::now() < task->dueTime_))
     {
-        shared_ptr<ThreadManager::Worker> worker = dynamic_pointer_cast<ThreadManager::Worker, Runnable>(newThread->runnable());
-        worker->state_ = ThreadManager::Worker::STARTING;
-        // 启动worker线程
-        newThread->start();
-        idMap_.insert(
-            std::pair<const Thread::id_t, shared_ptr<Thread>>(newThread->getId(), newThread));
+        promoteTimersUnderLock();
+        return;
     }
 
-    // 等待全部工作线程进入状态（执行run函数）
-    while (workerCount_ != workerMaxCount_)
+    // the watcher sleeps until the previous deadline
+    if (timerWatcher_ && timerWatcher_->parked_)
     {
-        workerMonitor_.wait();
+        wakeWorkerUnderLock(timerWatcher_);
+    }
+    else
+    {
+        watchTimersUnderLock();
     }
 }
 
-void ThreadManager::Impl::start()
+void ThreadManager::Impl::promoteTimersUnderLock()
 {
-    Guard g(mutex_);
-    if (state_ == ThreadManager::STOPPED)
+    const auto now = std::chrono::steady_clock::now();
+    size_t promoted = 0;
+    while (!timers_.empty() && !(now < timers_.front().due))
     {
-        return;
-    }
+        // a due timer that finds the queue full stays in the heap, the next
+        // worker to look for a task tries again
+        if (!tryReservePending())
+        {
+            break;
+        }
 
-    if (state_ == ThreadManager::UNINITIALIZED)
-    {
-        if (!threadFactory_)
+        ThreadManager::Task *task = timers_.front().task;
+        std::pop_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+        timers_.pop_back();
+
+        // the task stays WAITING, cancel() still works in the queue
+        if (!claimDequeued(task, ThreadManager::Task::WAITING))
         {
-            throw std::exception();
+            releasePending(true);
+            continue;
         }
-        state_ = ThreadManager::STARTED;
-        monitor_.notifyAll();
+        // enqueueTime_ shares dueTime_: the wait is counted from the due time
+        pushReserved(task);
+        ++promoted;
     }
 
-    while (state_ == STARTING)
+    nextTimer_ = timers_.empty() ? kNoTimer : timers_.front().due.time_since_epoch().count();
+    if (promoted > 0)
     {
-        monitor_.wait();
+        wakeIdleWorkersUnderLock(promoted);
     }
 }
 
-void ThreadManager::Impl::stop()
+void ThreadManager::Impl::promoteDueTimers(bool locked)
 {
-    Guard g(mutex_);
-    bool doStop = false;
-
-    if (state_ != ThreadManager::STOPPING && state_ != ThreadManager::JOINING && state_ != ThreadManager::STOPPED)
+    const int64_t next = nextTimer_.load(std::memory_order_relaxed);
+    if (next == kNoTimer || std::chrono::steady_clock::now().time_since_epoch().count() < next)
     {
-        doStop = true;
-        state_ = ThreadManager::JOINING;
+        return;
     }
-
-    if (doStop)
+    if (locked)
+    {
+        promoteTimersUnderLock();
+    }
+    else
     {
-        removeWorkersUnderLock(workerCount_);
+        Guard g(mutex_);
+        promoteTimersUnderLock();
     }
+}
 
-    state_ = ThreadManager::STOPPED;
+void ThreadManager::Impl::watchTimersUnderLock()
+{
+    if (!timers_.empty() && !timerWatcher_ && idleHead_)
+    {
+        wakeWorkerUnderLock(idleHead_);
+    }
 }
 
-void ThreadManager::Impl::removeWorker(size_t value)
+bool ThreadManager::Impl::reschedule(ThreadManager::Task *task)
 {
+    // fixed rate: the next deadline after now, runs missed meanwhile are skipped
+    const std::chrono::milliseconds period(task->period_);
+    const auto late = std::chrono::steady_clock::now() - task->dueTime_;
+    task->dueTime_ += period * (late / period + 1);
+
     Guard g(mutex_);
-    removeWorkersUnderLock(value);
+    if (state_ != ThreadManager::STARTED)
+    {
+        return false;
+    }
+    task->setState(ThreadManager::Task::WAITING);
+    addTimerUnderLock(task);
+    return true;
 }
 
-void ThreadManager::Impl::removeWorkersUnderLock(size_t value)
+void ThreadManager::Impl::watchExpiries(const Expiry *expiries, size_t count)
 {
-    if (value > workerMaxCount_)
+    Guard g(expiryMutex_);
+    if (reaperStopped_)
     {
-        throw std::exception();
+        return;
     }
 
-    workerMaxCount_ -= value;
-
-    if (idleCount_ > value)
+    if (!reaperRunning_ && threadFactory_)
     {
-        // There are more idle workers than we need to remove,
-        // so notify enough of them so they can terminate.
-        for (size_t ix = 0; ix < value; ix++)
+        try
+        {
+            reaper_ = threadFactory_->newThread(std::make_shared<ExpiryReaper>(this));
+            reaperRunning_ = true;
+            reaper_->start();
+        }
+        catch (...)
         {
-            monitor_.notify();
+            // expiry is still noticed on dequeue, and retried with the next task
+            reaper_.reset();
+            reaperRunning_ = false;
         }
     }
-    else
+
+    if (expiries_.size() + count > expiryCompactSize_)
     {
-        // There are as many or less idle workers than we need to remove,
-        // so just notify them all so they can terminate.
-        monitor_.notifyAll();
+        compactExpiriesUnderLock();
     }
 
-    // 等待工作线程减少到workerMaxCount_个数
-    while (workerCount_ != workerMaxCount_)
+    const bool wasEmpty = expiries_.empty();
+    const ThreadManager::Task::time_point earliest = wasEmpty ? ThreadManager::Task::NO_EXPIRATION : expiries_.front().expireTime;
+    for (size_t ix = 0; ix < count; ix++)
     {
-        workerMonitor_.wait();
+        expiries_.push_back(expiries[ix]);
+        std::push_heap(expiries_.begin(), expiries_.end(), std::greater<Expiry>());
     }
 
-    /**
-   * 从死亡工作线程集合deadWorkers_中移除所有的元素，并清空deadWorkers_
-  */
-    for (const auto &deadWorker : deadWorkers_)
+    // the reaper sleeps until the earliest expire time, only an earlier one needs it
+    if (wasEmpty || expiries_.front().expireTime < earliest)
     {
-
-        // when used with a joinable thread factory, we join the threads as we remove them
-        if (!threadFactory_->isDetached())
-        {
-            deadWorker->join();
-        }
-
-        idMap_.erase(deadWorker->getId());
-        workers_.erase(deadWorker);
+        expiryMonitor_.notifyAll();
     }
-
-    deadWorkers_.clear();
 }
 
-bool ThreadManager::Impl::canSleep() const
+bool ThreadManager::Impl::expiryDue(const ThreadManager::Task::time_point &now) const
 {
-    const Thread::id_t id = threadFactory_->getCurrentThreadId();
-    return idMap_.find(id) == idMap_.end();
+    if (tombstones_ > 0)
+    {
+        return true;
+    }
+    Guard g(expiryMutex_);
+    return !expiries_.empty() && expiries_.front().expireTime < now;
 }
 
-void ThreadManager::Impl::add(shared_ptr<Runnable> value, int64_t timeout, int64_t expiration)
+void ThreadManager::Impl::compactExpiriesUnderLock()
 {
-    Guard g(mutex_, timeout);
+    auto stale = [](const Expiry &expiry) {
+        return expiry.task->getGeneration() != expiry.generation ||
+               expiry.task->getState() != ThreadManager::Task::WAITING;
+    };
+    expiries_.erase(std::remove_if(expiries_.begin(), expiries_.end(), stale), expiries_.end());
+    std::make_heap(expiries_.begin(), expiries_.end(), std::greater<Expiry>());
 
-    if (!g)
-    {
-        throw std::exception();
-    }
+    // at least half of the entries go at the next compaction: amortized O(1) per entry
+    expiryCompactSize_ = std::max(kExpiryCompactMin, 2 * expiries_.size());
+}
 
-    if (state_ != ThreadManager::STARTED)
+void ThreadManager::Impl::reapExpired()
+{
+    std::vector<Expiry> due;
+    Guard g(expiryMutex_);
+    while (!reaperStopped_)
     {
-        throw std::exception(
-            "ThreadManager::Impl::add ThreadManager "
-            "not started");
-    }
+        if (expiries_.empty())
+        {
+            expiryMonitor_.waitForever();
+            continue;
+        }
 
-    // if we're at a limit, remove an expired task to see if the limit clears
-    if (pendingTaskCountMax_ > 0 && (tasks_.size() >= pendingTaskCountMax_))
-    {
-        removeExpired(true);
+        const auto now = std::chrono::steady_clock::now();
+        if (!(expiries_.front().expireTime < now))
+        {
+            // a copy: the heap changes while the lock is released
+            const ThreadManager::Task::time_point next = expiries_.front().expireTime;
+            expiryMonitor_.waitForTime(next);
+            continue;
+        }
+
+        while (!expiries_.empty() && expiries_.front().expireTime < now)
+        {
+            std::pop_heap(expiries_.begin(), expiries_.end(), std::greater<Expiry>());
+            due.push_back(expiries_.back());
+            expiries_.pop_back();
+        }
+
+        expiryMutex_.unlock();
+        reapDue(due);
+        due.clear();
+        expiryMutex_.lock();
     }
 
-    if (pendingTaskCountMax_ > 0 && (tasks_.size() >= pendingTaskCountMax_))
+    reaperRunning_ = false;
+    expiryMonitor_.notifyAll();
+}
+
+void ThreadManager::Impl::reapDue(std::vector<Expiry> &due)
+{
+    shared_ptr<const ExpireCallbacks> callbacks = std::atomic_load(&expireCallbacks_);
+    std::vector<shared_ptr<Runnable>> runnables;
+    size_t reaped = 0;
     {
-        if (canSleep() && timeout >= 0)
-        { // 带添加等待超时时间的task需先判断是否能等待，否则在等待时可能造成死锁
-            while (pendingTaskCountMax_ > 0 && tasks_.size() >= pendingTaskCountMax_)
+        // the callables of queued tasks are only read and moved under mutex_
+        Guard g(mutex_);
+        for (Expiry &expiry : due)
+        {
+            if (!expiry.task->transition(expiry.generation, ThreadManager::Task::WAITING, ThreadManager::Task::DROPPING))
             {
-                // This is thread safe because the mutex is shared between monitors.
-                maxMonitor_.wait(timeout);
+                // ran, removed or reused since it was indexed
+                expiry.task = nullptr;
+                continue;
+            }
+            if (callbacks)
+            {
+                runnables.push_back(expiry.task->takeRunnable());
             }
+            ++reaped;
         }
-        else
+    }
+    expiredCount_ += reaped;
+
+    for (const Expiry &expiry : due)
+    {
+        ThreadManager::Task *task = expiry.task;
+        if (!task)
         {
-            throw std::exception();
+            continue;
+        }
+        if (!callbacks && task->isAsync())
+        {
+            task->abandon();
         }
-    }
 
-    tasks_.push_back(std::make_shared<ThreadManager::Task>(value, expiration));
+        // leave a tombstone in the queue, unless the task was dequeued meanwhile
+        ++tombstones_;
+        if (!task->transition(expiry.generation, ThreadManager::Task::DROPPING, ThreadManager::Task::DROPPED))
+        {
+            --tombstones_;
+            recycleTask(task);
+        }
+    }
 
-    // If idle thread is available notify it, otherwise all worker threads are
-    // running and will get around to this task in time.
-    if (idleCount_ > 0)
+    if (callbacks && !runnables.empty())
     {
-        monitor_.notify();
+        fireExpireCallbacks(*callbacks, runnables);
     }
 }
 
-void ThreadManager::Impl::remove(shared_ptr<Runnable> task)
+void ThreadManager::Impl::stopReaper()
 {
-    Guard g(mutex_);
-    if (state_ != ThreadManager::STARTED)
+    shared_ptr<Thread> reaper;
     {
-        throw std::exception(
-            "ThreadManager::Impl::remove ThreadManager not "
-            "started");
+        Guard g(expiryMutex_);
+        reaperStopped_ = true;
+        expiryMonitor_.notifyAll();
+        while (reaperRunning_)
+        {
+            expiryMonitor_.wait();
+        }
+        reaper.swap(reaper_);
+        expiries_.clear();
     }
 
-    for (auto it = tasks_.begin(); it != tasks_.end(); ++it)
+    if (reaper && !threadFactory_->isDetached())
     {
-        if ((*it)->getRunnable() == task)
-        {
-            tasks_.erase(it);
-            return;
-        }
+        reaper->join();
     }
 }
 
-std::shared_ptr<Runnable> ThreadManager::Impl::removeNextPending()
+void ThreadManager::Impl::setElasticPolicy(const ThreadManager::ElasticPolicy &policy)
 {
-    Guard g(mutex_);
-    if (state_ != ThreadManager::STARTED)
+    if (policy.maxWorkers > 0 && policy.minWorkers > policy.maxWorkers)
     {
-        throw std::exception(
-            "ThreadManager::Impl::removeNextPending "
-            "ThreadManager not started");
+        throw std::exception();
     }
 
-    if (tasks_.empty())
+    Guard g(mutex_);
+    elastic_ = policy;
+    const bool enabled = policy.maxWorkers > 0;
+    elasticMax_ = policy.maxWorkers;
+    elasticQueueThreshold_ = enabled ? policy.queueThreshold : 0;
+    elasticWaitThreshold_ = enabled ? policy.waitThreshold : 0;
+
+    // parked workers pick up the new keep-alive when they park again
+    wakeIdleWorkersUnderLock(idleCount_);
+    if (enabled && state_ == ThreadManager::STARTED)
     {
-        return std::shared_ptr<Runnable>();
+        // apply the new bounds right away
+        requestScale();
     }
-
-    shared_ptr<ThreadManager::Task> task = tasks_.front();
-    tasks_.pop_front();
-
-    return task->getRunnable();
 }
 
-void ThreadManager::Impl::removeExpired(bool justOne)
+void ThreadManager::Impl::requestScale()
 {
-    // this is always called under a lock
-    if (tasks_.empty())
+    scaleRequested_ = true;
+    Guard g(scalerMutex_);
+    if (scalerStopped_)
     {
         return;
     }
-    auto now = std::chrono::steady_clock::now();
 
-    for (auto it = tasks_.begin(); it != tasks_.end();)
+    if (!scalerRunning_ && threadFactory_)
+    {
+        try
+        {
+            scaler_ = threadFactory_->newThread(std::make_shared<ElasticScaler>(this));
+            scalerRunning_ = true;
+            scaler_->start();
+        }
+        catch (...)
+        {
+            // the pool keeps its size, retried with the next request
+            scaler_.reset();
+            scalerRunning_ = false;
+            return;
+        }
+    }
+    scalerMonitor_.notify();
+}
+
+void ThreadManager::Impl::scaleWorkers()
+{
+    ThreadManager::Task::time_point backlogSince;
+    Guard g(scalerMutex_);
+    while (!scalerStopped_)
     {
-        if ((*it)->getExpireTime() && *((*it)->getExpireTime()) < now)
+        if (!scaleRequested_.exchange(false))
         {
-            if (expireCallback_)
+            // without a wait threshold only requests matter, otherwise the
+            // backlog is sampled a few times per threshold
+            const int64_t waitThreshold = elasticWaitThreshold_;
+            if (waitThreshold > 0)
+            {
+                scalerMonitor_.waitForTimeRelative(std::max(static_cast<int64_t>(1), waitThreshold / 4));
+            }
+            else
             {
-                expireCallback_((*it)->getRunnable());
+                scalerMonitor_.waitForever();
             }
-            it = tasks_.erase(it);
-            ++expiredCount_;
-            if (justOne)
+            if (scalerStopped_)
             {
-                return;
+                break;
             }
+            scaleRequested_ = false;
         }
-        else
+
+        scalerMutex_.unlock();
+        size_t demand;
         {
-            ++it;
+            Guard mg(mutex_);
+            demand = elasticDemandUnderLock(std::chrono::steady_clock::now(), backlogSince);
+        }
+        if (demand > 0)
+        {
+            try
+            {
+                // blocks this thread only, until the new workers run
+                addWorker(demand);
+                scaleRequested_ = true;
+            }
+            catch (const std::exception &e)
+            {
+                printf("[ERROR] ThreadManager failed to add a worker: %s", e.what());
+            }
         }
+        scalerMutex_.lock();
+    }
+
+    scalerRunning_ = false;
+    scalerMonitor_.notifyAll();
+}
+
+size_t ThreadManager::Impl::elasticDemandUnderLock(const ThreadManager::Task::time_point &now, ThreadManager::Task::time_point &backlogSince)
+{
+    reapDeadWorkersUnderLock();
+    if (state_ != ThreadManager::STARTED || elastic_.maxWorkers == 0)
+    {
+        backlogSince = ThreadManager::Task::time_point();
+        return 0;
+    }
+
+    if (workerMaxCount_ > elastic_.maxWorkers)
+    {
+        const size_t excess = workerMaxCount_ - elastic_.maxWorkers;
+        workerMaxCount_ -= excess;
+        wakeIdleWorkersUnderLock(excess, true);
+        return 0;
+    }
+    if (workerMaxCount_ < elastic_.minWorkers)
+    {
+        return elastic_.minWorkers - workerMaxCount_;
+    }
+
+    if (idleCount_ > 0 || pendingCount_ == 0 || workerMaxCount_ >= elastic_.maxWorkers)
+    {
+        backlogSince = ThreadManager::Task::time_point();
+        return 0;
+    }
+    if (elastic_.queueThreshold > 0 && pendingCount_ >= elastic_.queueThreshold)
+    {
+        backlogSince = now;
+        return 1;
+    }
+    if (backlogSince == ThreadManager::Task::time_point())
+    {
+        backlogSince = now;
+    }
+    else if (elastic_.waitThreshold > 0 && now - backlogSince >= std::chrono::milliseconds(elastic_.waitThreshold))
+    {
+        // every worker stayed busy with tasks waiting for the whole threshold
+        backlogSince = now;
+        return 1;
+    }
+    return 0;
+}
+
+void ThreadManager::Impl::stopScaler()
+{
+    shared_ptr<Thread> scaler;
+    {
+        Guard g(scalerMutex_);
+        scalerStopped_ = true;
+        scalerMonitor_.notifyAll();
+        while (scalerRunning_)
+        {
+            scalerMonitor_.wait();
+        }
+        scaler.swap(scaler_);
+    }
+
+    if (scaler && !threadFactory_->isDetached())
+    {
+        scaler->join();
     }
 }
 
 void ThreadManager::Impl::setExpireCallback(ExpireCallback expireCallback)
 {
     Guard g(mutex_);
-    expireCallback_ = expireCallback;
+    shared_ptr<const ExpireCallbacks> current = std::atomic_load(&expireCallbacks_);
+    auto callbacks = std::make_shared<ExpireCallbacks>();
+    callbacks->single = std::move(expireCallback);
+    callbacks->batch = current ? current->batch : ExpireBatchCallback();
+    std::atomic_store(&expireCallbacks_, (callbacks->single || callbacks->batch) ? shared_ptr<const ExpireCallbacks>(callbacks) : shared_ptr<const ExpireCallbacks>());
+    if (blocking_)
+    {
+        std::atomic_store(&blocking_->expireCallbacks_, std::atomic_load(&expireCallbacks_));
+    }
+}
+
+void ThreadManager::Impl::setExpireBatchCallback(ExpireBatchCallback expireCallback)
+{
+    Guard g(mutex_);
+    shared_ptr<const ExpireCallbacks> current = std::atomic_load(&expireCallbacks_);
+    auto callbacks = std::make_shared<ExpireCallbacks>();
+    callbacks->single = current ? current->single : ExpireCallback();
+    callbacks->batch = std::move(expireCallback);
+    std::atomic_store(&expireCallbacks_, (callbacks->single || callbacks->batch) ? shared_ptr<const ExpireCallbacks>(callbacks) : shared_ptr<const ExpireCallbacks>());
+    if (blocking_)
+    {
+        std::atomic_store(&blocking_->expireCallbacks_, std::atomic_load(&expireCallbacks_));
+    }
 }
 
 /**
@@ -681,7 +4033,15 @@ class SimpleThreadManager : public ThreadManager::Impl
 
 public:
     SimpleThreadManager(size_t workerCount = 4, size_t pendingTaskCountMax = 0)
-        : workerCount_(workerCount), pendingTaskCountMax_(pendingTaskCountMax) {}
+        : workerCount_(workerCount), pendingTaskCountMax_(pendingTaskCountMax)
+    {
+        // a bounded manager never holds more than pendingTaskCountMax tasks,
+        // so it can use a lock-free ring instead of the locked std::deque
+        if (pendingTaskCountMax_ > 0)
+        {
+            taskQueue(unique_ptr<PendingQueue>(new RingTaskQueue<ThreadManager::Task *>(pendingTaskCountMax_)));
+        }
+    }
 
     void start() override
     {
@@ -695,6 +4055,79 @@ private:
     const size_t pendingTaskCountMax_;
 };
 
+/**
+ * 工作窃取模式的简单线程管理器
+ */
+class WorkStealingThreadManager : public SimpleThreadManager
+{
+
+public:
+    WorkStealingThreadManager(size_t workerCount = 4, size_t pendingTaskCountMax = 0)
+        : SimpleThreadManager(workerCount, pendingTaskCountMax)
+    {
+        workStealing(true);
+    }
+};
+
+/**
+ * 按优先级调度的简单线程管理器
+ */
+class PriorityThreadManager : public SimpleThreadManager
+{
+
+public:
+    PriorityThreadManager(size_t workerCount = 4, size_t pendingTaskCountMax = 0, int64_t aging = 0)
+        : SimpleThreadManager(workerCount, pendingTaskCountMax)
+    {
+        priorityLanes(aging);
+    }
+};
+
+/**
+ * 多租户公平调度的简单线程管理器
+ */
+class FairThreadManager : public SimpleThreadManager
+{
+
+public:
+    FairThreadManager(size_t workerCount = 4, size_t pendingTaskCountMax = 0, size_t quantum = 1)
+        : SimpleThreadManager(workerCount, pendingTaskCountMax)
+    {
+        fairLanes(quantum);
+    }
+};
+
+void ThreadManager::Impl::blockingLane(size_t minWorkers, size_t maxWorkers, size_t pendingTaskCountMax, int64_t keepAlive)
+{
+    if (minWorkers == 0 && maxWorkers == 0)
+    {
+        throw std::exception();
+    }
+
+    ThreadManager::ElasticPolicy policy;
+    policy.minWorkers = minWorkers;
+    policy.maxWorkers = maxWorkers;
+    policy.keepAlive = keepAlive;
+    unique_ptr<ThreadManager::Impl> lane(new SimpleThreadManager(minWorkers, pendingTaskCountMax));
+    lane->setElasticPolicy(policy);
+
+    Guard g(mutex_);
+    if (state_ != ThreadManager::UNINITIALIZED || blocking_)
+    {
+        throw std::exception(
+            "ThreadManager::Impl::blockingLane ThreadManager "
+            "already started or blocking lane exists");
+    }
+    if (threadFactory_)
+    {
+        lane->threadFactory(threadFactory_);
+    }
+    lane->saturationPolicy(saturation_);
+    lane->recordLatencies(recordLatencies_);
+    std::atomic_store(&lane->expireCallbacks_, std::atomic_load(&expireCallbacks_));
+    blocking_ = std::move(lane);
+}
+
 shared_ptr<ThreadManager> ThreadManager::newThreadManager()
 {
     return shared_ptr<ThreadManager>(new ThreadManager::Impl());
@@ -705,4 +4138,38 @@ shared_ptr<ThreadManager> ThreadManager::newSimpleThreadManager(size_t count,
 {
     return shared_ptr<ThreadManager>(new SimpleThreadManager(count, pendingTaskCountMax));
 }
-}
\ No newline at end of file
+
+shared_ptr<ThreadManager> ThreadManager::newWorkStealingThreadManager(size_t count,
+                                                                      size_t pendingTaskCountMax)
+{
+    return shared_ptr<ThreadManager>(new WorkStealingThreadManager(count, pendingTaskCountMax));
+}
+
+shared_ptr<ThreadManager> ThreadManager::newPriorityThreadManager(size_t count,
+                                                                  size_t pendingTaskCountMax,
+                                                                  int64_t aging)
+{
+    return shared_ptr<ThreadManager>(new PriorityThreadManager(count, pendingTaskCountMax, aging));
+}
+
+shared_ptr<ThreadManager> ThreadManager::newFairThreadManager(size_t count,
+                                                              size_t pendingTaskCountMax,
+                                                              size_t quantum)
+{
+    return shared_ptr<ThreadManager>(new FairThreadManager(count, pendingTaskCountMax, quantum));
+}
+
+shared_ptr<ThreadManager> ThreadManager::newElasticThreadManager(size_t minWorkers,
+                                                                 size_t maxWorkers,
+                                                                 int64_t keepAlive,
+                                                                 size_t pendingTaskCountMax)
+{
+    ThreadManager::ElasticPolicy policy;
+    policy.minWorkers = minWorkers;
+    policy.maxWorkers = maxWorkers;
+    policy.keepAlive = keepAlive;
+    shared_ptr<ThreadManager> manager(new SimpleThreadManager(minWorkers, pendingTaskCountMax));
+    manager->setElasticPolicy(policy);
+    return manager;
+}
+}
@@ -1,8 +1,43 @@
+#ifndef _CONCURRENCY_THREADMANAGER_H_
+#define _CONCURRENCY_THREADMANAGER_H_ 1
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <functional>
+#include <vector>
+#include "Histogram.h"
 #include "ThreadFactory.h"
+#include "TaskFunction.h"
+#include "TaskQueue.h"
+
+// C++20 coroutine support (ThreadManager::schedule(), Coroutine.h)
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define CONCURRENCY_HAS_COROUTINES 1
+#endif
+#endif
 
 namespace concurrency {
+class TaskPool;
+class TaskRunnable;
+class TaskHandle;
+class TaskGroup;
+class FutureResultBase;
+#ifdef CONCURRENCY_HAS_COROUTINES
+class ScheduleAwaiter;
+#endif
+
+template <class R>
+class Future;
+
+/**
+ * Value type of the Future returned by ThreadManager::async() for callable F
+ */
+template <class F>
+using AsyncResultOf = typename std::decay<decltype(std::declval<typename std::decay<F>::type &>()())>::type;
+
 class ThreadManager
 {
 protected:
@@ -11,6 +46,11 @@ protected:
 public:
     typedef std::function<void(std::shared_ptr<Runnable>)> ExpireCallback;
 
+    /**
+   * Expire callback called once for all the tasks found expired together
+   */
+    typedef std::function<void(const std::vector<std::shared_ptr<Runnable>> &)> ExpireBatchCallback;
+
     virtual ~ThreadManager() = default;
 
     /**
@@ -20,10 +60,11 @@ public:
     virtual void start() = 0;
 
     /**
-   * Stops the thread manager. Aborts all remaining unprocessed task, shuts
-   * down all created worker threads, and releases all allocated resources.
-   * This method blocks for all worker threads to complete, thus it can
-   * potentially block forever if a worker thread is running a task that
+   * Stops the thread manager, stop(DRAIN): new tasks are refused, the tasks
+   * already queued are still run, then all the worker threads are shut down
+   * and the allocated resources released.  Timers that did not come due are
+   * dropped.  This method blocks for all worker threads to complete, thus it
+   * can potentially block forever if a worker thread is running a task that
    * won't terminate.
    *
    * Worker threads will be joined depending on the threadFactory's detached
@@ -31,6 +72,39 @@ public:
    */
     virtual void stop() = 0;
 
+    /**
+   * What stop() does with the tasks still queued.
+   *
+   * 停止方式：执行完队列中的任务、立即放弃、或在期限内尽量执行
+   */
+    enum STOP_MODE
+    {
+        DRAIN,      // run them all, as stop()
+        ABORT,      // hand them back right away
+        DRAIN_UNTIL // run them until the deadline, then hand back the rest
+    };
+
+    /**
+   * Stops the thread manager the way mode says.  Tasks that are handed back
+   * are returned, or if an expire callback is set, given to it in one batch
+   * as if they had expired (and counted by expiredTaskCount()).  They are
+   * taken off the queues at once under the manager lock, and idle workers
+   * are woken one by one on their own futex, so a large backlog costs
+   * little more than its removal.  Tasks already running, or already taken
+   * by a worker in one batch, always complete: the call still blocks until
+   * every worker thread is done.  Calls blocked in add() on a full queue
+   * fail.  A blocking lane is stopped the same way, within the deadline that
+   * is left.
+   *
+   * 按指定方式停止线程管理器，返回未执行的任务
+   *
+   * \param deadline milliseconds from now, DRAIN_UNTIL only
+   *
+   * \returns the tasks not run, empty if an expire callback took them or
+   * the manager was already stopped
+   */
+    virtual std::vector<std::shared_ptr<Runnable>> stop(STOP_MODE mode, int64_t deadline = 0LL) = 0;
+
     enum STATE
     {
         UNINITIALIZED,
@@ -43,6 +117,42 @@ public:
 
     virtual STATE state() const = 0;
 
+    /**
+   * Task priority levels, HIGHEST is run first.  Only managers created by
+   * newPriorityThreadManager() keep a lane per level, the others run every
+   * task in FIFO order and count them all as NORMAL.
+   *
+   * 任务优先级
+   */
+    enum PRIORITY
+    {
+        HIGHEST,
+        HIGH,
+        NORMAL,
+        LOW,
+        LOWEST
+    };
+
+    static constexpr size_t kPriorityLevels = LOWEST + 1;
+
+    /**
+   * What add() does when pendingTaskCountMax() tasks are already pending,
+   * see saturationPolicy().
+   *
+   * 队列已满时的处理策略
+   */
+    enum SATURATION
+    {
+        // 阻塞等待名额（工作线程上或timeout为-1时抛出异常），默认策略
+        BLOCK,
+        // 立即返回无效的TaskHandle，不抛出异常
+        REJECT,
+        // 在调用线程上直接执行任务
+        CALLER_RUNS,
+        // 丢弃最早的挂起任务（交给过期回调），让出名额给新任务
+        DROP_OLDEST
+    };
+
     /**
    * \returns the current thread factory
    */
@@ -57,8 +167,14 @@ public:
 
     /**
    * Adds worker thread(s).
+   * The threads are created and started without holding the manager lock
+   * and without waiting for each other, then the call blocks once until all
+   * of them run.
    * 
    * 增加指定个数工作线程
+   *
+   * \throws std::exception if a thread could not be started, the ones that
+   *                        did are kept
    */
     virtual void addWorker(size_t value = 1) = 0;
 
@@ -95,6 +211,22 @@ public:
    */
     virtual size_t pendingTaskCount() const = 0;
 
+    /**
+   * Gets the number of pending tasks of one priority level.  Tasks that are
+   * being handed to a worker are not counted.
+   *
+   * 获取指定优先级的挂起任务个数
+   */
+    virtual size_t pendingTaskCount(PRIORITY priority) const = 0;
+
+    /**
+   * Gets the number of pending tasks of one tenant, see submitWithTenant().
+   * Managers without fair queues count every task as tenant 0.
+   *
+   * 获取指定租户的挂起任务个数
+   */
+    virtual size_t tenantPendingTaskCount(uint32_t tenant) const = 0;
+
     /**
    * Gets the current number of pending and executing tasks
    * 
@@ -117,6 +249,96 @@ public:
    */
     virtual size_t expiredTaskCount() const = 0;
 
+    /**
+   * Sets what add(), submit() and async() do when the queue is full and no
+   * expired task can be removed to make room, unless a call names its own
+   * policy:
+   *
+   * BLOCK: wait for room as described for add(), throwing on a worker
+   * thread or with timeout = -1.
+   *
+   * REJECT: give the task up at once and return an invalid TaskHandle (an
+   * async() Future completes with std::future_errc::broken_promise).
+   *
+   * CALLER_RUNS: run the task on the calling thread before returning, which
+   * also slows the producer down to the pace of the pool.
+   *
+   * DROP_OLDEST: take the oldest pending task off the queues, the least
+   * urgent one with priority lanes, of the tenant queueing the most tasks
+   * with fair queues, hand it to the expire callback and queue
+   * the new task in its slot.  Falls back to BLOCK when every slot is held by
+   * a task on its way into a queue.
+   *
+   * addBatch() always admits what fits and leaves the rest to the caller.
+   *
+   * 设置队列满时的默认处理策略（默认BLOCK），单次add()/submit()可另行指定
+   */
+    virtual void saturationPolicy(SATURATION value) = 0;
+
+    /**
+   * 获取队列满时的默认处理策略
+   */
+    virtual SATURATION saturationPolicy() const = 0;
+
+    /**
+   * Snapshot of the manager's counters, see stats().
+   *
+   * 线程管理器统计信息快照
+   */
+    struct Stats
+    {
+        size_t workerCount;
+        size_t idleWorkerCount;
+        size_t pendingTaskCount;
+        size_t pendingTaskCountMax;
+        size_t expiredTaskCount;
+
+        /**
+     * Tasks run by worker threads, continuations run inline are not counted
+     */
+        uint64_t executedTaskCount;
+
+        /**
+     * Times a worker stole from a peer (work-stealing mode), and went idle
+     */
+        uint64_t stealCount;
+        uint64_t parkCount;
+
+        /**
+     * Time from add() to the start of the run, and run time, in nanoseconds;
+     * empty unless recordLatencies(true)
+     */
+        HistogramSnapshot queueWait;
+        HistogramSnapshot runTime;
+
+        /**
+     * The blocking lane's workers and queue, 0 without one.  The worker and
+     * queue sizes above leave the lane out, expiredTaskCount and the
+     * counters and histograms above include it
+     */
+        size_t blockingWorkerCount;
+        size_t blockingIdleWorkerCount;
+        size_t blockingPendingTaskCount;
+        size_t blockingPendingTaskCountMax;
+    };
+
+    /**
+   * Reads every counter without taking the manager lock.  Worker counters
+   * live on per-worker cache lines and are summed here, so the snapshot is
+   * not atomic as a whole and can briefly miss a retiring worker.
+   *
+   * 无锁获取统计信息：各worker的计数器独占缓存行，读取时汇总
+   */
+    virtual Stats stats() const = 0;
+
+    /**
+   * Enables the queueWait and runTime histograms of stats(), off by default:
+   * it costs three clock reads per task.
+   *
+   * 开启任务等待时间和执行时间直方图（每个任务增加三次时钟读取）
+   */
+    virtual void recordLatencies(bool value) = 0;
+
     /**
    * Adds a task to be executed at some time in the future by a worker thread.
    * 
@@ -138,22 +360,334 @@ public:
    * 
    * @param expiration when nonzero, the number of milliseconds the task is valid
    * to be run; if exceeded, the task will be dropped off the queue and not run.
+   * A reaper thread, started with the first such task, hands expired tasks to
+   * the expire callback as soon as they expire rather than when a worker
+   * reaches them.  Until a worker dequeues its leftover, an expired task still
+   * counts in pendingTaskCount().
    * 
-   * 任务等待执行的超时时间
+   * 任务等待执行的超时时间，过期后由后台回收线程主动触发过期回调
    *
    * @throws TooManyPendingTasksException Pending task count exceeds max pending task count
+   *
+   * @return a handle for cancel(), which can simply be ignored
+   *
+   * What happens on a full queue depends on saturationPolicy(), BLOCK
+   * (described above) by default.
+   */
+    virtual TaskHandle add(std::shared_ptr<Runnable> task,
+                           int64_t timeout = 0LL,
+                           int64_t expiration = 0LL) = 0;
+
+    /**
+   * add() with its own saturation policy instead of saturationPolicy().
+   *
+   * 按指定的队列满处理策略添加任务
+   *
+   * @return an invalid handle if policy is REJECT and the task was given up
+   */
+    TaskHandle add(std::shared_ptr<Runnable> task,
+                   SATURATION policy,
+                   int64_t timeout = 0LL,
+                   int64_t expiration = 0LL);
+
+    /**
+   * add() with a priority level, see PRIORITY.
+   *
+   * 按优先级添加任务
+   */
+    TaskHandle addWithPriority(std::shared_ptr<Runnable> task,
+                               PRIORITY priority,
+                               int64_t timeout = 0LL,
+                               int64_t expiration = 0LL);
+
+    /**
+   * addWithPriority() with its own saturation policy, see add().
+   */
+    TaskHandle addWithPriority(std::shared_ptr<Runnable> task,
+                               PRIORITY priority,
+                               SATURATION policy,
+                               int64_t timeout = 0LL,
+                               int64_t expiration = 0LL);
+
+    /**
+   * submit() with a priority level, see PRIORITY.
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submitWithPriority(F &&task, PRIORITY priority, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    virtual TaskHandle submitWithPriority(TaskFunction &&task,
+                                          PRIORITY priority,
+                                          int64_t timeout = 0LL,
+                                          int64_t expiration = 0LL) = 0;
+
+    /**
+   * submitWithPriority() with its own saturation policy, see add().
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submitWithPriority(F &&task,
+                                  PRIORITY priority,
+                                  SATURATION policy,
+                                  int64_t timeout = 0LL,
+                                  int64_t expiration = 0LL);
+
+    virtual TaskHandle submitWithPriority(TaskFunction &&task,
+                                          PRIORITY priority,
+                                          SATURATION policy,
+                                          int64_t timeout = 0LL,
+                                          int64_t expiration = 0LL) = 0;
+
+    /**
+   * add() on behalf of a tenant, see submitWithTenant().
+   *
+   * 以租户身份添加任务
+   */
+    TaskHandle addWithTenant(std::shared_ptr<Runnable> task,
+                             uint32_t tenant,
+                             int64_t timeout = 0LL,
+                             int64_t expiration = 0LL);
+
+    /**
+   * addWithTenant() with its own saturation policy, see add().
+   */
+    TaskHandle addWithTenant(std::shared_ptr<Runnable> task,
+                             uint32_t tenant,
+                             SATURATION policy,
+                             int64_t timeout = 0LL,
+                             int64_t expiration = 0LL);
+
+    /**
+   * submit() on behalf of a tenant.  Managers created by
+   * newFairThreadManager() keep a queue per tenant and serve the tenants
+   * with queued tasks in turn, so that a tenant flooding the pool only
+   * delays its own tasks; the others run every task in FIFO order.  Tasks
+   * added without a tenant, by add(), addBatch() or the timers, belong to
+   * tenant 0.
+   *
+   * When the tenant's queue holds its pendingTaskCountMax (see tenantShare())
+   * the task is handled like on a full queue, see saturationPolicy();
+   * DROP_OLDEST evicts the oldest task of that tenant.
+   *
+   * 以租户身份提交任务：公平队列模式下每个租户一个队列，按权重轮流调度
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submitWithTenant(F &&task, uint32_t tenant, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    virtual TaskHandle submitWithTenant(TaskFunction &&task,
+                                        uint32_t tenant,
+                                        int64_t timeout = 0LL,
+                                        int64_t expiration = 0LL) = 0;
+
+    /**
+   * submitWithTenant() with its own saturation policy, see add().
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submitWithTenant(F &&task,
+                                uint32_t tenant,
+                                SATURATION policy,
+                                int64_t timeout = 0LL,
+                                int64_t expiration = 0LL);
+
+    virtual TaskHandle submitWithTenant(TaskFunction &&task,
+                                        uint32_t tenant,
+                                        SATURATION policy,
+                                        int64_t timeout = 0LL,
+                                        int64_t expiration = 0LL) = 0;
+
+    /**
+   * Sets the share of a tenant in a manager created by newFairThreadManager():
+   * each turn of the tenant runs up to quantum * weight of its tasks, and at
+   * most pendingTaskCountMax of its tasks are pending at a time (0: only the
+   * manager's pendingTaskCountMax() applies).  Tenants never configured have
+   * weight 1 and no limit of their own.  Tenant 0 can not be limited, it
+   * holds the tasks added in batches and by the timers.
+   *
+   * 设置租户的权重与最大挂起任务个数
+   *
+   * \throws std::exception if the manager has no fair queues, or for a limit
+   * on tenant 0
+   */
+    virtual void tenantShare(uint32_t tenant, uint32_t weight, size_t pendingTaskCountMax = 0) = 0;
+
+    /**
+   * Adds the Runnables of [first, last) under a single lock acquisition.
+   *
+   * 批量添加任务：只加锁一次，一次性预占挂起任务名额并唤醒min(个数, 空闲线程数)个工作线程
+   *
+   * When pendingTaskCountMax() is not zero only as many tasks as there is room
+   * for are admitted, in order, and the rest is left to the caller.  If there
+   * is no room at all the call waits like add() until at least one task fits,
+   * giving up after timeout milliseconds (timeout = -1: never wait), but
+   * never throws TooManyPendingTasksException.
+   *
+   * @return the number of tasks accepted, counted from first
+   */
+    template <class Iterator>
+    size_t addBatch(Iterator first, Iterator last, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    /**
+   * Adds any move-only callable as a task, with the same blocking, timeout and
+   * expiration semantics as add().  Closures up to TaskFunction::kInlineSize
+   * bytes are stored inline in the pooled task: no allocation and no
+   * reference counting on the way to the worker.
+   *
+   * 添加任意可调用对象作为任务，小闭包直接存放在任务对象中，无需包装为shared_ptr<Runnable>
+   *
+   * Tasks submitted this way are handed to the expire callback and returned by
+   * removeNextPending() wrapped in a FunctionRunnable.
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submit(F &&task, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    /**
+   * Type-erased form of submit(), add() is a thin adapter over it.
+   */
+    virtual TaskHandle submit(TaskFunction &&task, int64_t timeout = 0LL, int64_t expiration = 0LL) = 0;
+
+    /**
+   * submit() with its own saturation policy, see add().
+   */
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submit(F &&task, SATURATION policy, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    virtual TaskHandle submit(TaskFunction &&task,
+                              SATURATION policy,
+                              int64_t timeout = 0LL,
+                              int64_t expiration = 0LL) = 0;
+
+    /**
+   * Creates the blocking lane: a second, elastic group of workers with its
+   * own queue, for tasks that spend their time waiting on I/O, locks or
+   * sleeps, so that they can not occupy the workers that run CPU bound tasks.
+   * Tasks are routed to it by addBlocking() and submitBlocking().
+   *
+   * 创建阻塞任务通道：独立的弹性工作线程组和任务队列，专门执行会阻塞（I/O等）的任务
+   *
+   * The lane grows from minWorkers up to maxWorkers while its tasks wait,
+   * and workers idle for keepAlive ms retire, see ElasticPolicy.  It is
+   * started and stopped with the manager and shares its thread factory,
+   * saturation policy, expire callbacks and stats(); workerCount(),
+   * pendingTaskCount() and the other accessors describe the CPU workers only.
+   * Must be called before start(), at most once.
+   *
+   * \param pendingTaskCountMax 阻塞任务队列的最大长度，0 不限制
+   *
+   * \throws std::exception if the manager was started, the lane exists
+   * already or minWorkers is greater than maxWorkers
+   */
+    virtual void blockingLane(size_t minWorkers,
+                              size_t maxWorkers,
+                              size_t pendingTaskCountMax = 0,
+                              int64_t keepAlive = 60000LL) = 0;
+
+    /**
+   * add() for a task that blocks: it is queued on the blocking lane, or on
+   * the CPU workers like add() if the manager has no blocking lane.  The
+   * lane's pendingTaskCountMax applies, the calling thread may block on a
+   * full lane under the BLOCK policy even if it is a CPU worker.
+   *
+   * 添加会阻塞的任务，由阻塞任务通道执行
    */
-    virtual void add(std::shared_ptr<Runnable> task,
-                     int64_t timeout = 0LL,
-                     int64_t expiration = 0LL) = 0;
+    TaskHandle addBlocking(std::shared_ptr<Runnable> task, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    template <class F,
+              class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskHandle submitBlocking(F &&task, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+    virtual TaskHandle submitBlocking(TaskFunction &&task, int64_t timeout = 0LL, int64_t expiration = 0LL) = 0;
+
+    /**
+   * Adds a task to be run once, delay milliseconds from now.
+   *
+   * 添加延迟执行的任务
+   *
+   * The task waits in a timer heap rather than in the pending task queue:
+   * it is not counted in pendingTaskCount() and does not block on a full
+   * queue.  There is no timer thread, a parked worker sleeps until the
+   * earliest deadline and moves the due tasks into the queue, where they
+   * wait like any other task (for room too, if pendingTaskCountMax() is
+   * reached).  The handle cancels the task until it starts.
+   *
+   * \throws std::exception if the thread manager is not started
+   */
+    virtual TaskHandle addDelayed(std::shared_ptr<Runnable> task, int64_t delay) = 0;
+
+    /**
+   * Runs a task every interval milliseconds, the first time one interval
+   * from now, until stop() or cancel().  Runs are scheduled at a fixed rate
+   * from the first deadline; a run that is missed because the previous one
+   * was late is skipped rather than run back to back, and the task never
+   * runs concurrently with itself.  A run that throws ends the schedule.
+   *
+   * 添加周期执行的任务
+   *
+   * The handle cancels the task while it waits for its next run, cancel()
+   * fails while it is running.
+   *
+   * \throws std::exception if interval is not positive or the thread
+   * manager is not started
+   */
+    virtual TaskHandle addPeriodic(std::shared_ptr<Runnable> task, int64_t interval) = 0;
+
+    /**
+   * Adds a callable as a task and returns a Future for its result, with the
+   * same blocking, timeout and expiration semantics as add().
+   *
+   * 添加任务并返回其结果的Future：共享状态存放在池化的任务对象中，不额外分配内存
+   *
+   * The shared state lives inside the pooled task: the result is stored next
+   * to the callable and completion is signalled through an atomic word, so
+   * a small closure costs no allocation at all.  A task that is expired or
+   * removed without being run completes its Future with
+   * std::future_errc::broken_promise, unless the Runnable handed to the expire
+   * callback or returned by removeNextPending() is run.
+   *
+   * A Future must not outlive the thread manager that created it.
+   */
+    template <class F>
+    Future<AsyncResultOf<F>> async(F &&task, int64_t timeout = 0LL, int64_t expiration = 0LL);
+
+#ifdef CONCURRENCY_HAS_COROUTINES
+    /**
+   * Awaitable moving the awaiting coroutine onto a worker thread:
+   * co_await manager.schedule() suspends it and queues its resumption,
+   * see Coroutine.h.
+   *
+   * 协程调度：co_await后协程在工作线程上恢复执行
+   */
+    ScheduleAwaiter schedule();
+#endif
 
     /**
    * Removes a pending task
    * 
    * 移除一个挂起的任务
+   *
+   * This searches the queues and the timers for the Runnable, cancel() is
+   * O(1).  A periodic task found there does not run again.  Tasks of
+   * submit() and async() carry no Runnable and are only cancelled through
+   * their handle.
    */
     virtual void remove(std::shared_ptr<Runnable> task) = 0;
 
+    /**
+   * Cancels a task that has not started running, in O(1) and without taking
+   * the manager lock: the task is marked DROPPED in place and skipped by the
+   * worker that dequeues it, which also gives back its pending slot.  Its
+   * Future, if any, completes with std::future_errc::broken_promise.  The
+   * expire callback is not called.
+   *
+   * 取消尚未开始执行的任务：只修改任务状态，出队时由worker跳过
+   *
+   * @return false if the task already started, ran, expired or was removed
+   */
+    virtual bool cancel(const TaskHandle &handle) = 0;
+
     /**
    * Remove the next pending task which would be run.
    * 
@@ -175,11 +709,127 @@ public:
    * 
    * 设置超时回调函数
    *
+   * The callback never runs under the manager lock: it is called on the
+   * thread that found the task expired (a worker, the reaper, or a producer
+   * making room in a full queue) once the lock was released.  What it throws
+   * is logged and swallowed.
+   *
    * @param expireCallback a function called with the shared_ptr<Runnable> for
    * the expired task.
    */
     virtual void setExpireCallback(ExpireCallback expireCallback) = 0;
 
+    /**
+   * Set a callback called once per sweep with every task found expired
+   * together, instead of once per task.  When set it replaces the callback
+   * given to setExpireCallback().
+   *
+   * 设置批量超时回调函数：每次清理只调用一次
+   */
+    virtual void setExpireBatchCallback(ExpireBatchCallback expireCallback) = 0;
+
+    /**
+   * Sets the maximum number of tasks a worker takes off the pending task
+   * queue per lock acquisition, 1 by default.  The batch is run without
+   * holding the lock, its expiration check and the wake-up of producers
+   * blocked on a full queue happen once per batch.  A worker never takes
+   * more than its share of the queue while other workers are idle.
+   *
+   * 设置工作线程每次加锁从任务队列中批量获取的最大任务数（默认1），适用于执行时间很短的任务
+   *
+   * Only the locked std::deque queue is batched; work-stealing workers
+   * already move batches into their local queue.
+   */
+    virtual void dequeueBatchSize(size_t value) = 0;
+
+    /**
+   * 获取工作线程每次批量获取的最大任务数
+   */
+    virtual size_t dequeueBatchSize() const = 0;
+
+    /**
+   * Bounds and thresholds of an elastic pool, see setElasticPolicy().
+   *
+   * 弹性线程池策略
+   */
+    struct ElasticPolicy
+    {
+        ElasticPolicy()
+            : minWorkers(0),
+              maxWorkers(0),
+              keepAlive(60000),
+              queueThreshold(1),
+              waitThreshold(0) {}
+
+        // 最少、最多工作线程数，maxWorkers为0表示关闭弹性伸缩
+        size_t minWorkers;
+        size_t maxWorkers;
+
+        // 工作线程空闲超过keepAlive毫秒后退出（不少于minWorkers个）
+        int64_t keepAlive;
+
+        // 没有空闲线程且挂起任务数达到queueThreshold时增加线程，0 不按队列长度扩容
+        size_t queueThreshold;
+
+        // 没有空闲线程且任务持续挂起超过waitThreshold毫秒时增加线程，0 不按等待时间扩容
+        int64_t waitThreshold;
+    };
+
+    /**
+   * Lets the pool grow and shrink between policy.minWorkers and
+   * policy.maxWorkers on its own: a worker is added when no worker is idle
+   * and either queueThreshold tasks are pending or tasks have been pending
+   * for waitThreshold ms, and a worker idle for keepAlive ms retires while
+   * there are more than minWorkers.  Workers are added by a background
+   * thread, add() callers never wait for a thread to start.  A maxWorkers of
+   * 0 turns the policy off, addWorker() and removeWorker() work as before.
+   *
+   * 设置弹性伸缩策略：根据负载自动增加或减少工作线程
+   *
+   * \throws std::exception if minWorkers is greater than maxWorkers
+   */
+    virtual void setElasticPolicy(const ElasticPolicy &policy) = 0;
+
+    virtual ElasticPolicy elasticPolicy() const = 0;
+
+    /**
+   * How an idle worker waits for its next task, see setIdlePolicy().
+   *
+   * 空闲等待策略：先忙等，再让出CPU，最后停车
+   */
+    struct IdlePolicy
+    {
+        IdlePolicy()
+            : spinCount(0),
+              yieldCount(0),
+              hotWorkers(0) {}
+
+        // 停车前忙等（pause指令）检查新任务的次数
+        uint32_t spinCount;
+
+        // 忙等之后、停车之前让出CPU（yield）检查新任务的次数
+        uint32_t yieldCount;
+
+        // 始终轮询、从不停车的空闲线程个数（低延迟模式），0 不保留
+        size_t hotWorkers;
+    };
+
+    /**
+   * Lets idle workers wait for a task by polling before they park: spinCount
+   * checks with a pause hint in between, then yieldCount checks giving the
+   * CPU away, then the futex wait.  Up to hotWorkers idle workers never park:
+   * past their spinCount checks they keep polling, yielding in between, until
+   * a task comes, trading a core each for the wake-up latency.  Handing a
+   * task to a polling worker costs no system call.  A hot worker does not
+   * retire after the elastic keep-alive.  The default policy parks right
+   * away; the blocking lane always does.
+   *
+   * 设置空闲等待策略：忙等期间到达的任务无需系统调用即可被取走
+   */
+    virtual void setIdlePolicy(const IdlePolicy &policy) = 0;
+
+    virtual IdlePolicy idlePolicy() const = 0;
+
     static std::shared_ptr<ThreadManager> newThreadManager();
 
     /**
@@ -193,6 +843,71 @@ public:
     static std::shared_ptr<ThreadManager> newSimpleThreadManager(size_t count = 4,
                                                                  size_t pendingTaskCountMax = 0);
 
+    /**
+   * Creates a work-stealing thread manager with count worker threads.
+   * Each worker owns a local task queue: tasks added from a worker thread go
+   * onto that worker's queue, tasks added from other threads go into a shared
+   * injection queue, and idle workers steal from their peers.
+   *
+   * With a thread factory binding workers to NUMA nodes
+   * (ThreadFactory::NUMA_NODES), tasks added from other threads are queued on
+   * a worker of the caller's node, and thieves try their own node first.
+   *
+   * 创建工作窃取模式的线程管理器：每个worker拥有本地任务队列，空闲的worker从其他worker窃取任务
+   *
+   * \param count worker threads（工作线程）个数
+   * @param pendingTaskCountMax 最大挂起任务个数（所有队列之和），0 不限制
+   */
+    static std::shared_ptr<ThreadManager> newWorkStealingThreadManager(size_t count = 4,
+                                                                       size_t pendingTaskCountMax = 0);
+
+    /**
+   * Creates a thread manager whose pending tasks are kept in one FIFO lane
+   * per PRIORITY level; the most urgent non-empty lane is found in O(1).
+   *
+   * 创建按优先级调度的线程管理器
+   *
+   * \param count worker threads（工作线程）个数
+   * @param pendingTaskCountMax 最大挂起任务个数，0 不限制
+   * @param aging when nonzero, a pending task gains one priority level every
+   * aging milliseconds so that low priority tasks can not starve（老化时间，0 不老化）
+   */
+    static std::shared_ptr<ThreadManager> newPriorityThreadManager(size_t count = 4,
+                                                                   size_t pendingTaskCountMax = 0,
+                                                                   int64_t aging = 0);
+
+    /**
+   * Creates a thread manager keeping a FIFO queue per tenant, served by
+   * weighted deficit round-robin, see submitWithTenant() and tenantShare().
+   * Only tenants with pending tasks take part in the rounds, so idle
+   * tenants cost nothing.
+   *
+   * 创建多租户公平调度的线程管理器
+   *
+   * \param count worker threads（工作线程）个数
+   * @param pendingTaskCountMax 最大挂起任务个数（所有租户之和），0 不限制
+   * @param quantum tasks a tenant of weight 1 runs per turn（每轮可执行的任务数）
+   */
+    static std::shared_ptr<ThreadManager> newFairThreadManager(size_t count = 4,
+                                                               size_t pendingTaskCountMax = 0,
+                                                               size_t quantum = 1);
+
+    /**
+   * Creates a thread manager starting minWorkers threads and growing up to
+   * maxWorkers under load, see setElasticPolicy().
+   *
+   * 创建弹性伸缩的线程管理器
+   *
+   * \param minWorkers 最少工作线程个数
+   * @param maxWorkers 最多工作线程个数
+   * @param keepAlive 空闲线程保留的毫秒数
+   * @param pendingTaskCountMax 最大挂起任务个数，0 不限制
+   */
+    static std::shared_ptr<ThreadManager> newElasticThreadManager(size_t minWorkers,
+                                                                  size_t maxWorkers,
+                                                                  int64_t keepAlive = 60000,
+                                                                  size_t pendingTaskCountMax = 0);
+
     // 任务
     class Task;
 
@@ -201,5 +916,515 @@ public:
 
     // ThreadManager Implement 线程管理器接口的实现，ThreadManager 是一个接口
     class Impl;
+
+protected:
+    /**
+   * Takes an empty task from the pool, used by async() to build the task in place.
+   */
+    virtual Task *acquireTask() = 0;
+
+    /**
+   * Queues a task obtained from acquireTask(), see add() for timeout, under
+   * saturationPolicy().  On failure the queue's reference to the task is
+   * dropped before throwing; a task given up or run inline by the policy is
+   * disposed of the same way.
+   */
+    virtual void enqueueTask(Task *task, int64_t timeout) = 0;
+
+    /**
+   * Queues as many tasks of a batch from acquireTask() as are admitted, see
+   * addBatch().  The tasks that are not admitted are given back to the pool.
+   * \returns the number of tasks admitted, always a prefix of the batch
+   */
+    virtual size_t enqueueBatch(Task *const *tasks, size_t count, int64_t timeout) = 0;
+
+    /**
+   * \returns whether the calling thread is one of this manager's workers
+   */
+    virtual bool onWorkerThread() const = 0;
+
+    /**
+   * Takes one task off the calling worker's local queue, the shared queue or
+   * a peer, and runs it on the calling thread; used by TaskGroup::wait().
+   * \returns false if no task was found or the caller is not a worker
+   */
+    virtual bool runPendingTask() = 0;
+
+    friend class TaskGroup;
+#ifdef CONCURRENCY_HAS_COROUTINES
+    friend class ScheduleAwaiter;
+#endif
+};
+
+/**
+ * 可执行的任务类
+ *
+ * 使用代理模式封装了可执行的任务对象（TaskFunction），可通过expireTime_控制等待任务执行的超时时间
+ *
+ * Tasks are pooled by the manager (see TaskPool) and handed around as raw
+ * pointers; the callable and the expire time are stored inline, NO_EXPIRATION
+ * meaning never.
+ *
+ * The state word also carries a generation, bumped by every reset(), so that
+ * the expiry reaper and TaskHandle can claim a queued task with a single CAS
+ * and never mistake a reused task for the one they refer to.
+ *
+ * A task created by async() also holds the shared state of its Future: the
+ * result lives in the callable, completion is an atomic futex word, and the
+ * task is reference counted by the manager and the Future so that it only
+ * goes back to the pool once both are done with it.
+ *
+ * async()创建的任务同时作为Future的共享状态，由线程管理器和Future共同持有引用计数
+ *
+ * A task spans two cache lines and shares none with another task: the
+ * callable with the state word and the expiration a worker checks before
+ * running it, then the rest of the bookkeeping.  A single 64-byte node would leave no room for
+ * an inline callable, so the target is two lines, not one.  The due time of
+ * a timer, the enqueue time and the free list link share one slot, a task
+ * never needs two of them at once.
+ */
+class alignas(kCacheLineSize) ThreadManager::Task
+{
+
+public:
+    enum STATE
+    {
+        WAITING,
+        EXECUTING,
+        TIMEDOUT,
+        COMPLETE,
+        DROPPING, // being expired or cancelled while still queued
+        DROPPED   // expired or cancelled in place, recycled by whoever dequeues it
+    };
+
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    /**
+   * 永不过期的哨兵值
+   */
+    static constexpr time_point NO_EXPIRATION = time_point::max();
+
+    Task()
+        : state_(stampOf(0, WAITING)),
+          expireTime_(NO_EXPIRATION),
+          next_(nullptr),
+          period_(0),
+          owner_(nullptr),
+          result_(nullptr),
+          continuation_(nullptr),
+          signal_(FUTURE_PENDING),
+          refs_(1),
+          priority_(NORMAL),
+          tenant_(0) {}
+
+    /**
+   * (Re)initializes a pooled task.
+   */
+    void reset(TaskFunction &&function, uint64_t expiration = 0ULL)
+    {
+        function_ = std::move(function);
+        // a new generation: stale references to the previous use never match
+        state_.store(stampOf(getGeneration() + 1, WAITING), std::memory_order_relaxed);
+        priority_ = NORMAL;
+        tenant_ = 0;
+        enqueueTime_ = time_point();
+        period_ = 0;
+        expireTime_ = expiration != 0ULL
+                          ? std::chrono::steady_clock::now() + std::chrono::milliseconds(expiration)
+                          : NO_EXPIRATION;
+    }
+
+    /**
+   * Destroys the callable and the future state before the task goes back to
+   * the pool.
+   */
+    void clear()
+    {
+        function_.reset();
+        result_ = nullptr;
+        signal_.store(FUTURE_PENDING, std::memory_order_relaxed);
+        refs_.store(1, std::memory_order_relaxed);
+        continuation_.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // 只有在state_ == EXECUTING时才可被执行
+    void run()
+    {
+        if (getState() == EXECUTING)
+        {
+            function_();
+            setState(COMPLETE);
+            if (result_)
+            {
+                complete();
+            }
+        }
+    }
+
+    /**
+   * \returns the Runnable given to add(), empty for tasks added by submit()
+   * or async()
+   */
+    std::shared_ptr<Runnable> getRunnable() const { return function_.runnable(); }
+
+    /**
+   * Hands the callable out as a Runnable for a task that will not run
+   * (expired or removed), wrapping it if it was added by submit().  For an
+   * async() task the Runnable keeps the task alive and completes its Future.
+   */
+    std::shared_ptr<Runnable> takeRunnable();
+
+    /**
+   * 获取任务超时时间
+   */
+    const time_point &getExpireTime() const { return expireTime_; }
+
+    bool hasExpireTime() const { return expireTime_ != NO_EXPIRATION; }
+
+    bool isExpired(const time_point &now) const { return expireTime_ < now; }
+
+    ThreadManager::PRIORITY getPriority() const { return priority_; }
+
+    uint32_t getTenant() const { return tenant_; }
+
+    STATE getState() const { return static_cast<STATE>(state_.load(std::memory_order_acquire) & kStateMask); }
+
+    /**
+   * Incremented by every reset(), tells apart the successive uses of a pooled task.
+   */
+    uint32_t getGeneration() const { return static_cast<uint32_t>(state_.load(std::memory_order_acquire) >> 32); }
+
+    /**
+   * Sets the state of a task the caller owns, i.e. that is not in a queue.
+   */
+    void setState(STATE state) { state_.store(stampOf(getGeneration(), state), std::memory_order_release); }
+
+    /**
+   * Atomically moves generation from one state to another.
+   * \returns false if the task is in another state or was reused
+   */
+    bool transition(uint32_t generation, STATE from, STATE to)
+    {
+        uint64_t expected = stampOf(generation, from);
+        return state_.compare_exchange_strong(expected, stampOf(generation, to), std::memory_order_acq_rel);
+    }
+
+    /**
+   * Takes ownership of a task that was just taken off a queue by moving it
+   * from WAITING to state.
+   *
+   * 出队后取得任务的所有权，与过期回收线程竞争
+   *
+   * \returns state on success, otherwise what the reaper or cancel() left:
+   * DROPPED means the caller only recycles the task, DROPPING means the
+   * dropper is still on it and recycles it itself
+   */
+    STATE claim(STATE state)
+    {
+        uint64_t stamp = state_.load(std::memory_order_acquire);
+        for (;;)
+        {
+            const STATE current = static_cast<STATE>(stamp & kStateMask);
+            if (current != WAITING && current != DROPPING)
+            {
+                return current;
+            }
+            const STATE next = current == WAITING ? state : DROPPED;
+            if (state_.compare_exchange_weak(stamp, (stamp & ~kStateMask) | next, std::memory_order_acq_rel))
+            {
+                return current == WAITING ? state : DROPPING;
+            }
+        }
+    }
+
+    /**
+   * Whether the task was created by async() and carries a Future.
+   */
+    bool isAsync() const { return result_ != nullptr; }
+
+    /**
+   * Completes the Future of a task that will never run with
+   * std::future_errc::broken_promise.
+   */
+    void abandon();
+
+    /**
+   * Drops one reference, the last one gives the task back to its pool.
+   */
+    void release();
+
+private:
+    static constexpr uint64_t kStateMask = 0xffffffffULL;
+
+    static uint64_t stampOf(uint32_t generation, STATE state) { return (static_cast<uint64_t>(generation) << 32) | state; }
+
+    /**
+   * Values of signal_, the futex word of the Future
+   */
+    enum SIGNAL : uint32_t
+    {
+        FUTURE_PENDING,
+        FUTURE_WAITED, // pending, and at least one thread is blocked on it
+        FUTURE_READY
+    };
+
+    /**
+   * Turns a freshly reset task into an async() task referenced by both the
+   * manager and a Future.
+   */
+    void makeAsync(FutureResultBase *result)
+    {
+        result_ = result;
+        refs_.store(2, std::memory_order_relaxed);
+    }
+
+    bool isReady() const { return signal_.load(std::memory_order_acquire) == FUTURE_READY; }
+
+    void wait();
+
+    bool waitFor(int64_t timeout);
+
+    /**
+   * Publishes the result, wakes up waiters, then runs the continuation on
+   * the calling thread.
+   */
+    void complete();
+
+    /**
+   * Sets the continuation, or runs it right away if the task already completed.
+   */
+    void attach(Task *continuation);
+
+    void runContinuation();
+
+    /**
+   * Takes an empty task from the same pool, for a continuation.
+   */
+    Task *newContinuation();
+
+    TaskFunction function_;
+    friend class ThreadManager;
+    friend class ThreadManager::Worker;
+    friend class ThreadManager::Impl;
+    friend class TaskPool;
+    friend class TaskRunnable;
+    template <class R>
+    friend class Future;
+
+    /**
+   * 世代（高32位）与状态（低32位），出队的worker与过期回收线程通过CAS竞争任务
+   */
+    std::atomic<uint64_t> state_;
+    time_point expireTime_;
+
+    // second cache line
+    union
+    {
+        /**
+       * addDelayed()/addPeriodic()任务的到期时间；定时任务在到期时入队，
+       * 到期时间即其入队时间
+       */
+        time_point dueTime_;
+
+        /**
+       * 入队时间，仅在记录延迟时设置
+       */
+        time_point enqueueTime_;
+
+        /**
+       * 空闲链表中的下一个任务，仅在对象池中使用
+       */
+        Task *next_;
+    };
+
+    /**
+   * addDelayed()/addPeriodic()任务的执行周期（毫秒，0 只执行一次）
+   */
+    int64_t period_;
+    ThreadManager::Impl *owner_;
+
+    /**
+   * async()任务的结果，普通任务为nullptr
+   */
+    FutureResultBase *result_;
+
+    /**
+   * then()设置的后续任务；任务完成后置为this
+   */
+    std::atomic<Task *> continuation_;
+    std::atomic<uint32_t> signal_;
+    std::atomic<uint32_t> refs_;
+    ThreadManager::PRIORITY priority_;
+
+    /**
+   * 所属租户，仅公平队列使用
+   */
+    uint32_t tenant_;
+};
+
+/**
+ * Lightweight handle on a task added by add() or submit(), for
+ * ThreadManager::cancel().  It names a pooled task and one of its
+ * generations, so it never matches the task once it is reused; copying it
+ * takes no reference.  A handle must not be used after its thread manager
+ * is destroyed.
+ *
+ * 任务句柄：任务对象地址加世代号，用于O(1)取消任务
+ */
+class TaskHandle
+{
+public:
+    TaskHandle() noexcept : task_(nullptr), generation_(0) {}
+
+    /**
+   * \returns false for a default constructed handle
+   */
+    bool valid() const noexcept { return task_ != nullptr; }
+
+    /**
+   * \returns true while the task waits in a queue, i.e. cancel() may still succeed;
+   * only a snapshot
+   */
+    bool isPending() const
+    {
+        return task_ && task_->getGeneration() == generation_ && task_->getState() == ThreadManager::Task::WAITING;
+    }
+
+private:
+    friend class ThreadManager::Impl;
+
+    TaskHandle(ThreadManager::Task *task, uint32_t generation) noexcept : task_(task), generation_(generation) {}
+
+    ThreadManager::Task *task_;
+    uint32_t generation_;
 };
-}
\ No newline at end of file
+
+inline TaskHandle ThreadManager::addWithPriority(std::shared_ptr<Runnable> task,
+                                                 PRIORITY priority,
+                                                 int64_t timeout,
+                                                 int64_t expiration)
+{
+    return submitWithPriority(TaskFunction(RunnableCall(std::move(task))), priority, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submitWithPriority(F &&task, PRIORITY priority, int64_t timeout, int64_t expiration)
+{
+    return submitWithPriority(TaskFunction(std::forward<F>(task)), priority, timeout, expiration);
+}
+
+inline TaskHandle ThreadManager::addWithPriority(std::shared_ptr<Runnable> task,
+                                                 PRIORITY priority,
+                                                 SATURATION policy,
+                                                 int64_t timeout,
+                                                 int64_t expiration)
+{
+    return submitWithPriority(TaskFunction(RunnableCall(std::move(task))), priority, policy, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submitWithPriority(F &&task,
+                                             PRIORITY priority,
+                                             SATURATION policy,
+                                             int64_t timeout,
+                                             int64_t expiration)
+{
+    return submitWithPriority(TaskFunction(std::forward<F>(task)), priority, policy, timeout, expiration);
+}
+
+inline TaskHandle ThreadManager::addWithTenant(std::shared_ptr<Runnable> task,
+                                               uint32_t tenant,
+                                               int64_t timeout,
+                                               int64_t expiration)
+{
+    return submitWithTenant(TaskFunction(RunnableCall(std::move(task))), tenant, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submitWithTenant(F &&task, uint32_t tenant, int64_t timeout, int64_t expiration)
+{
+    return submitWithTenant(TaskFunction(std::forward<F>(task)), tenant, timeout, expiration);
+}
+
+inline TaskHandle ThreadManager::addWithTenant(std::shared_ptr<Runnable> task,
+                                               uint32_t tenant,
+                                               SATURATION policy,
+                                               int64_t timeout,
+                                               int64_t expiration)
+{
+    return submitWithTenant(TaskFunction(RunnableCall(std::move(task))), tenant, policy, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submitWithTenant(F &&task,
+                                           uint32_t tenant,
+                                           SATURATION policy,
+                                           int64_t timeout,
+                                           int64_t expiration)
+{
+    return submitWithTenant(TaskFunction(std::forward<F>(task)), tenant, policy, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submit(F &&task, int64_t timeout, int64_t expiration)
+{
+    return submit(TaskFunction(std::forward<F>(task)), timeout, expiration);
+}
+
+inline TaskHandle ThreadManager::add(std::shared_ptr<Runnable> task,
+                                     SATURATION policy,
+                                     int64_t timeout,
+                                     int64_t expiration)
+{
+    return submit(TaskFunction(RunnableCall(std::move(task))), policy, timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submit(F &&task, SATURATION policy, int64_t timeout, int64_t expiration)
+{
+    return submit(TaskFunction(std::forward<F>(task)), policy, timeout, expiration);
+}
+
+inline TaskHandle ThreadManager::addBlocking(std::shared_ptr<Runnable> task, int64_t timeout, int64_t expiration)
+{
+    return submitBlocking(TaskFunction(RunnableCall(std::move(task))), timeout, expiration);
+}
+
+template <class F, class>
+TaskHandle ThreadManager::submitBlocking(F &&task, int64_t timeout, int64_t expiration)
+{
+    return submitBlocking(TaskFunction(std::forward<F>(task)), timeout, expiration);
+}
+
+template <class Iterator>
+size_t ThreadManager::addBatch(Iterator first, Iterator last, int64_t timeout, int64_t expiration)
+{
+    std::vector<Task *> tasks;
+    try
+    {
+        for (; first != last; ++first)
+        {
+            tasks.push_back(nullptr);
+            tasks.back() = acquireTask();
+            tasks.back()->reset(TaskFunction(RunnableCall(*first)), expiration);
+        }
+    }
+    catch (...)
+    {
+        for (Task *task : tasks)
+        {
+            if (task)
+            {
+                task->release();
+            }
+        }
+        throw;
+    }
+    return tasks.empty() ? 0 : enqueueBatch(tasks.data(), tasks.size(), timeout);
+}
+}
+
+#include "Future.h"
+#include "Coroutine.h"
+
+#endif
@@ -0,0 +1,242 @@
+#include "Trace.h"
+#include "Mutex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace concurrency {
+namespace {
+uint64_t nanosNow() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+/**
+ * Timestamp counter: rdtsc on x86, the steady clock in nanoseconds elsewhere
+ */
+uint64_t ticks() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return nanosNow();
+#endif
+}
+
+/**
+ * One event; relaxed atomics so that a dump may read a ring being written
+ */
+struct TraceEntry {
+  std::atomic<uint64_t> time;
+  std::atomic<uint64_t> object;
+  // the event in the low 8 bits, the id above
+  std::atomic<uint64_t> tag;
+};
+
+struct alignas(64) TraceBuffer {
+  explicit TraceBuffer(uint32_t id) : head(0), cleared(0), owned(true), tid(id) {}
+
+  // only written by the owning thread
+  std::atomic<uint64_t> head;
+  // events before this index were dropped by Trace::clear()
+  std::atomic<uint64_t> cleared;
+  std::atomic<bool> owned;
+  const uint32_t tid;
+  TraceEntry entries[Trace::kBufferEvents];
+};
+
+/**
+ * 所有线程的环形缓冲区，以及换算时间戳所用的起始时刻
+ */
+struct TraceRegistry {
+  TraceRegistry() : startTicks(ticks()), startNanos(nanosNow()) {}
+
+  Mutex mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+  const uint64_t startTicks;
+  const uint64_t startNanos;
+};
+
+TraceRegistry &registry() {
+  // never destroyed: threads may still record while statics are torn down
+  static TraceRegistry *instance = new TraceRegistry();
+  return *instance;
+}
+
+/**
+ * Hands the ring back to the registry when its thread exits
+ */
+struct LocalBuffer {
+  ~LocalBuffer() {
+    if (buffer) {
+      buffer->owned.store(false, std::memory_order_release);
+    }
+  }
+
+  TraceBuffer *buffer = nullptr;
+};
+
+thread_local LocalBuffer localBuffer;
+
+TraceBuffer *attachBuffer() {
+  TraceRegistry &traces = registry();
+  Guard g(traces.mutex);
+  for (const auto &buffer : traces.buffers) {
+    if (!buffer->owned.load(std::memory_order_acquire)) {
+      buffer->owned.store(true, std::memory_order_relaxed);
+      return buffer.get();
+    }
+  }
+  traces.buffers.emplace_back(new TraceBuffer(static_cast<uint32_t>(traces.buffers.size() + 1)));
+  return traces.buffers.back().get();
+}
+
+struct TraceRecord {
+  uint64_t time;
+  uint64_t object;
+  uint64_t tag;
+};
+
+/**
+ * Writes the JSON object of an event, in the Chrome trace event format
+ */
+void writeEvent(FILE *out, uint32_t tid, double ts, const TraceRecord &record) {
+  const Trace::EVENT event = static_cast<Trace::EVENT>(record.tag & 0xff);
+  const unsigned long long object = static_cast<unsigned long long>(record.object);
+  const unsigned id = static_cast<unsigned>(record.tag >> 8);
+  fprintf(out, ",\n{\"pid\":1,\"tid\":%u,\"ts\":%.3f,", tid, ts);
+  switch (event) {
+  case Trace::ADD_WAIT:
+    fputs("\"name\":\"add blocked\",\"cat\":\"add\",\"ph\":\"B\"}", out);
+    break;
+  case Trace::ADD_RESUME:
+    fputs("\"name\":\"add blocked\",\"cat\":\"add\",\"ph\":\"E\"}", out);
+    break;
+  case Trace::ENQUEUE:
+  case Trace::DEQUEUE:
+    // an async slice per task generation, from the push to the pop
+    fprintf(out,
+            "\"name\":\"queued\",\"cat\":\"queue\",\"ph\":\"%s\",\"id\":\"0x%llx.%u\"}",
+            event == Trace::ENQUEUE ? "b" : "e",
+            object,
+            id);
+    break;
+  case Trace::START:
+    fprintf(out, "\"name\":\"run\",\"cat\":\"task\",\"ph\":\"B\",\"args\":{\"task\":\"0x%llx.%u\"}}", object, id);
+    break;
+  case Trace::FINISH:
+    fputs("\"name\":\"run\",\"cat\":\"task\",\"ph\":\"E\"}", out);
+    break;
+  case Trace::EXPIRE:
+    fprintf(out,
+            "\"name\":\"expired\",\"cat\":\"task\",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"task\":\"0x%llx.%u\"}}",
+            object,
+            id);
+    break;
+  case Trace::STEAL:
+    fprintf(out, "\"name\":\"steal\",\"cat\":\"worker\",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"tasks\":%u}}", id);
+    break;
+  case Trace::PARK:
+    fputs("\"name\":\"park\",\"cat\":\"worker\",\"ph\":\"B\"}", out);
+    break;
+  default:
+    fputs("\"name\":\"park\",\"cat\":\"worker\",\"ph\":\"E\"}", out);
+    break;
+  }
+}
+}
+
+void Trace::record(EVENT event, const void *object, uint32_t id) noexcept {
+  TraceBuffer *buffer = localBuffer.buffer;
+  if (!buffer) {
+    try {
+      buffer = localBuffer.buffer = attachBuffer();
+    } catch (...) {
+      return;
+    }
+  }
+  const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  TraceEntry &entry = buffer->entries[head & (kBufferEvents - 1)];
+  entry.time.store(ticks(), std::memory_order_relaxed);
+  entry.object.store(reinterpret_cast<uintptr_t>(object), std::memory_order_relaxed);
+  entry.tag.store((static_cast<uint64_t>(id) << 8) | event, std::memory_order_relaxed);
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::writeChromeTrace(const std::string &path) {
+  FILE *out = fopen(path.c_str(), "w");
+  if (!out) {
+    printf("[ERROR] Trace::writeChromeTrace can not open %s", path.c_str());
+    return false;
+  }
+
+  TraceRegistry &traces = registry();
+  const uint64_t endTicks = ticks();
+  const uint64_t endNanos = nanosNow();
+  // timestamp counter ticks per microsecond, measured since the registry was created
+  const double perMicro = endNanos > traces.startNanos && endTicks > traces.startTicks
+                              ? static_cast<double>(endTicks - traces.startTicks) * 1000.0 /
+                                    static_cast<double>(endNanos - traces.startNanos)
+                              : 1000.0;
+
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ThreadManager\"}}",
+        out);
+  std::vector<TraceRecord> records;
+  Guard g(traces.mutex);
+  for (const auto &buffer : traces.buffers) {
+    fprintf(out,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+            buffer->tid,
+            buffer->tid);
+
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    const uint64_t first =
+        std::max(buffer->cleared.load(std::memory_order_relaxed), head > kBufferEvents ? head - kBufferEvents : 0);
+    records.clear();
+    for (uint64_t ix = first; ix < head; ix++) {
+      const TraceEntry &entry = buffer->entries[ix & (kBufferEvents - 1)];
+      records.push_back(TraceRecord{entry.time.load(std::memory_order_relaxed),
+                                    entry.object.load(std::memory_order_relaxed),
+                                    entry.tag.load(std::memory_order_relaxed)});
+    }
+
+    // the owner may have lapped the copy meanwhile: drop what it could have
+    // overwritten, including the entry it may be writing right now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t after = buffer->head.load(std::memory_order_relaxed);
+    const uint64_t valid = after >= kBufferEvents ? after - kBufferEvents + 1 : 0;
+    for (uint64_t ix = std::max(first, valid); ix < head; ix++) {
+      const TraceRecord &record = records[ix - first];
+      const double ts = static_cast<double>(static_cast<int64_t>(record.time - traces.startTicks)) / perMicro;
+      writeEvent(out, buffer->tid, ts, record);
+    }
+  }
+  fputs("\n]}\n", out);
+
+  const bool failed = ferror(out) != 0;
+  if (fclose(out) != 0 || failed) {
+    printf("[ERROR] Trace::writeChromeTrace can not write %s", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+void Trace::clear() {
+  TraceRegistry &traces = registry();
+  Guard g(traces.mutex);
+  for (const auto &buffer : traces.buffers) {
+    buffer->cleared.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+}
+}
@@ -0,0 +1,76 @@
+#ifndef _CONCURRENCY_TRACE_H_
+#define _CONCURRENCY_TRACE_H_ 1
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace concurrency {
+/**
+ * Task lifecycle tracing, compiled in when CONCURRENCY_TRACING is defined
+ * for the whole build.
+ *
+ * 任务生命周期跟踪：编译时定义CONCURRENCY_TRACING开启，每个线程独占一个无锁环形缓冲区
+ *
+ * Every thread that records an event gets a ring buffer of its own, so the
+ * hot path writes one cache line nobody else writes: a timestamp counter
+ * read (rdtsc on x86) and three relaxed stores.  A ring keeps the last
+ * kBufferEvents events of its thread; the ring of a thread that exited is
+ * handed to the next new thread.  Without CONCURRENCY_TRACING the trace
+ * points expand to nothing and writeChromeTrace() writes an empty trace.
+ */
+class Trace
+{
+public:
+    enum EVENT : uint8_t
+    {
+        ADD_WAIT,   // add() blocks on a full queue
+        ADD_RESUME, // add() got a slot or gave up
+        ENQUEUE,    // a task is pushed onto a queue
+        DEQUEUE,    // a worker took a task off a queue
+        START,      // a task starts running
+        FINISH,     // a task returned
+        EXPIRE,     // a task expired without running
+        STEAL,      // a worker stole tasks from a peer, id is their count
+        PARK,       // a worker goes idle
+        UNPARK      // a parked worker woke up
+    };
+
+    /**
+   * Events kept per thread, a power of two
+   */
+    static constexpr size_t kBufferEvents = 1 << 14;
+
+    /**
+   * Appends an event to the calling thread's ring.  object and id name
+   * the task (its address and generation), both are 0 for worker events.
+   */
+    static void record(EVENT event, const void *object, uint32_t id) noexcept;
+
+    /**
+   * Writes the events recorded so far as Chrome trace JSON, which
+   * chrome://tracing and Perfetto open: one track per thread, running tasks,
+   * parks and blocked add() calls as slices, queue waits as async slices
+   * from enqueue to dequeue.  Safe while workers record; a ring that wraps
+   * meanwhile loses its oldest events.
+   *
+   * 导出为Chrome trace JSON格式（可用chrome://tracing或Perfetto查看）
+   *
+   * \returns false if the file could not be written
+   */
+    static bool writeChromeTrace(const std::string &path);
+
+    /**
+   * Drops the events recorded so far from the dumps that follow.
+   */
+    static void clear();
+};
+}
+
+#ifdef CONCURRENCY_TRACING
+#define CONCURRENCY_TRACE(event, object, id) ::concurrency::Trace::record(::concurrency::Trace::event, (object), (id))
+#else
+#define CONCURRENCY_TRACE(event, object, id) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,560 @@
+#include "ThreadManager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace concurrency;
+
+/**
+ * 线程管理器基准测试
+ *
+ * ThreadManager microbenchmarks, results are printed to stdout as one JSON
+ * document so that runs can be compared between releases:
+ *
+ *   bench [--quick] [--only <name>]
+ *
+ * 1. throughput   空任务吞吐量与工作线程数的关系
+ * 2. latency      add()到run()的延迟分位数
+ * 3. backpressure 有界队列下生产者的阻塞情况
+ * 4. expiration   大量过期任务
+ * 5. churn        addWorker()/removeWorker()的开销
+ * 6. stoprace     与stop(ABORT)竞争的submit()：被接受的任务必须执行或被交还
+ *
+ * The process exits with 1 if stoprace lost a task.
+ */
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(const Clock::time_point &start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Minimal JSON writer, values are appended in order.
+ */
+class Json
+{
+public:
+    void beginObject(const char *key = nullptr)
+    {
+        this->key(key);
+        out_ += '{';
+        first_ = true;
+    }
+
+    void endObject()
+    {
+        out_ += '}';
+        first_ = false;
+    }
+
+    void beginArray(const char *key)
+    {
+        this->key(key);
+        out_ += '[';
+        first_ = true;
+    }
+
+    void endArray()
+    {
+        out_ += ']';
+        first_ = false;
+    }
+
+    void value(const char *key, double value)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.6g", value);
+        this->key(key);
+        out_ += buffer;
+    }
+
+    void flag(const char *key, bool value)
+    {
+        this->key(key);
+        out_ += value ? "true" : "false";
+    }
+
+    void value(const char *key, const char *value)
+    {
+        this->key(key);
+        out_ += '"';
+        out_ += value;
+        out_ += '"';
+    }
+
+    const std::string &str() const { return out_; }
+
+private:
+    void key(const char *key)
+    {
+        if (!first_)
+        {
+            out_ += ',';
+        }
+        first_ = false;
+        if (key)
+        {
+            out_ += '"';
+            out_ += key;
+            out_ += "\":";
+        }
+    }
+
+    std::string out_;
+    bool first_ = true;
+};
+
+class Empty : public Runnable
+{
+public:
+    explicit Empty(std::atomic<size_t> &done) : done_(done) {}
+
+    void run() override { done_.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    std::atomic<size_t> &done_;
+};
+
+void spinFor(std::chrono::nanoseconds duration)
+{
+    const auto until = Clock::now() + duration;
+    while (Clock::now() < until)
+    {
+    }
+}
+
+void waitFor(const std::atomic<size_t> &done, size_t count)
+{
+    while (done.load(std::memory_order_relaxed) < count)
+    {
+        std::this_thread::yield();
+    }
+}
+
+std::shared_ptr<ThreadManager> newManager(bool stealing, size_t workers, size_t pendingTaskCountMax = 0)
+{
+    std::shared_ptr<ThreadManager> manager = stealing
+                                                 ? ThreadManager::newWorkStealingThreadManager(workers, pendingTaskCountMax)
+                                                 : ThreadManager::newSimpleThreadManager(workers, pendingTaskCountMax);
+    manager->threadFactory(std::make_shared<ThreadFactory>(false));
+    manager->start();
+    return manager;
+}
+
+const char *modeName(bool stealing) { return stealing ? "work-stealing" : "simple"; }
+
+double percentile(std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void writePercentiles(Json &json, std::vector<double> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    json.value("p50_us", percentile(samples, 0.50));
+    json.value("p99_us", percentile(samples, 0.99));
+    json.value("p999_us", percentile(samples, 0.999));
+    json.value("max_us", samples.empty() ? 0 : samples.back());
+}
+
+/**
+ * Empty tasks through add() and submit(), from one and from four producers.
+ */
+void throughput(Json &json, bool quick)
+{
+    const size_t tasks = quick ? 100000 : 1000000;
+    std::vector<size_t> workerCounts = {1, 2, 4, 8};
+    size_t hardware = std::thread::hardware_concurrency();
+    if (hardware > 8)
+    {
+        workerCounts.push_back(hardware);
+    }
+
+    json.beginArray("throughput");
+    for (bool stealing : {false, true})
+    {
+        for (size_t workers : workerCounts)
+        {
+            for (size_t producers : {static_cast<size_t>(1), static_cast<size_t>(4)})
+            {
+                for (bool callable : {false, true})
+                {
+                    auto manager = newManager(stealing, workers);
+                    std::atomic<size_t> done(0);
+                    auto task = std::make_shared<Empty>(done);
+
+                    auto start = Clock::now();
+                    std::vector<std::thread> threads;
+                    for (size_t ix = 0; ix < producers; ix++)
+                    {
+                        threads.emplace_back([&, ix]() {
+                            size_t count = tasks / producers + (ix < tasks % producers ? 1 : 0);
+                            for (size_t jx = 0; jx < count; jx++)
+                            {
+                                if (callable)
+                                {
+                                    manager->submit([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                                }
+                                else
+                                {
+                                    manager->add(task);
+                                }
+                            }
+                        });
+                    }
+                    for (auto &thread : threads)
+                    {
+                        thread.join();
+                    }
+                    waitFor(done, tasks);
+                    double seconds = secondsSince(start);
+                    manager->stop();
+
+                    json.beginObject();
+                    json.value("mode", modeName(stealing));
+                    json.value("api", callable ? "submit" : "add");
+                    json.value("workers", static_cast<double>(workers));
+                    json.value("producers", static_cast<double>(producers));
+                    json.value("tasks", static_cast<double>(tasks));
+                    json.value("seconds", seconds);
+                    json.value("tasks_per_second", tasks / seconds);
+                    json.endObject();
+                }
+            }
+        }
+    }
+    json.endArray();
+}
+
+/**
+ * Time from add() to the start of run(), under a light paced load.
+ */
+void latency(Json &json, bool quick)
+{
+    const size_t samples = quick ? 20000 : 200000;
+    const size_t burst = 16;
+
+    json.beginArray("latency");
+    for (bool stealing : {false, true})
+    {
+        auto manager = newManager(stealing, 4);
+        std::vector<double> latencies(samples);
+        std::atomic<size_t> done(0);
+
+        for (size_t ix = 0; ix < samples; ix++)
+        {
+            auto added = Clock::now();
+            manager->submit([&latencies, &done, added, ix]() {
+                latencies[ix] = std::chrono::duration<double, std::micro>(Clock::now() - added).count();
+                done.fetch_add(1, std::memory_order_release);
+            });
+            if (ix % burst == burst - 1)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        waitFor(done, samples);
+        manager->stop();
+
+        json.beginObject();
+        json.value("mode", modeName(stealing));
+        json.value("workers", 4);
+        json.value("samples", static_cast<double>(samples));
+        writePercentiles(json, latencies);
+        json.endObject();
+    }
+    json.endArray();
+}
+
+/**
+ * Producers against newSimpleThreadManager(n, max): time spent in add()
+ * while the bounded queue is full.
+ */
+void backpressure(Json &json, bool quick)
+{
+    const size_t tasks = quick ? 50000 : 500000;
+    const size_t producers = 4;
+
+    json.beginArray("backpressure");
+    for (bool stealing : {false, true})
+    {
+        for (size_t pendingTaskCountMax : {static_cast<size_t>(16), static_cast<size_t>(1024)})
+        {
+            auto manager = newManager(stealing, 4, pendingTaskCountMax);
+            std::atomic<size_t> done(0);
+            std::vector<std::vector<double>> waits(producers);
+
+            auto start = Clock::now();
+            std::vector<std::thread> threads;
+            for (size_t ix = 0; ix < producers; ix++)
+            {
+                threads.emplace_back([&, ix]() {
+                    waits[ix].reserve(tasks / producers);
+                    for (size_t jx = 0; jx < tasks / producers; jx++)
+                    {
+                        auto before = Clock::now();
+                        manager->submit([&done]() {
+                            spinFor(std::chrono::microseconds(1));
+                            done.fetch_add(1, std::memory_order_relaxed);
+                        });
+                        waits[ix].push_back(std::chrono::duration<double, std::micro>(Clock::now() - before).count());
+                    }
+                });
+            }
+            for (auto &thread : threads)
+            {
+                thread.join();
+            }
+            waitFor(done, tasks / producers * producers);
+            double seconds = secondsSince(start);
+            manager->stop();
+
+            std::vector<double> all;
+            for (auto &wait : waits)
+            {
+                all.insert(all.end(), wait.begin(), wait.end());
+            }
+
+            json.beginObject();
+            json.value("mode", modeName(stealing));
+            json.value("workers", 4);
+            json.value("producers", static_cast<double>(producers));
+            json.value("pending_task_count_max", static_cast<double>(pendingTaskCountMax));
+            json.value("tasks_per_second", all.size() / seconds);
+            json.beginObject("add_wait");
+            writePercentiles(json, all);
+            json.endObject();
+            json.endObject();
+        }
+    }
+    json.endArray();
+}
+
+/**
+ * Overloaded workers and short expirations: most tasks expire in the queue.
+ */
+void expiration(Json &json, bool quick)
+{
+    const size_t tasks = quick ? 20000 : 200000;
+
+    json.beginArray("expiration");
+    for (bool stealing : {false, true})
+    {
+        for (bool bounded : {false, true})
+        {
+            auto manager = newManager(stealing, 2, bounded ? 1024 : 0);
+            std::atomic<size_t> ran(0);
+            std::atomic<size_t> expired(0);
+            manager->setExpireCallback([&expired](std::shared_ptr<Runnable>) { expired.fetch_add(1, std::memory_order_relaxed); });
+
+            auto start = Clock::now();
+            for (size_t ix = 0; ix < tasks; ix++)
+            {
+                manager->submit([&ran]() {
+                    spinFor(std::chrono::microseconds(5));
+                    ran.fetch_add(1, std::memory_order_relaxed);
+                },
+                                0, 1);
+            }
+            double addSeconds = secondsSince(start);
+            while (ran + expired < tasks)
+            {
+                manager->removeExpiredTasks();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            double seconds = secondsSince(start);
+            manager->stop();
+
+            json.beginObject();
+            json.value("mode", modeName(stealing));
+            json.flag("bounded", bounded);
+            json.value("tasks", static_cast<double>(tasks));
+            json.value("ran", static_cast<double>(ran));
+            json.value("expired", static_cast<double>(expired));
+            json.value("add_seconds", addSeconds);
+            json.value("seconds", seconds);
+            json.endObject();
+        }
+    }
+    json.endArray();
+}
+
+/**
+ * addWorker()/removeWorker() round trips while tasks keep flowing.
+ */
+void churn(Json &json, bool quick)
+{
+    const size_t rounds = quick ? 100 : 1000;
+
+    json.beginArray("churn");
+    for (bool stealing : {false, true})
+    {
+        auto manager = newManager(stealing, 2);
+        std::atomic<size_t> done(0);
+        std::atomic<bool> stop(false);
+        std::thread producer([&]() {
+            while (!stop)
+            {
+                manager->submit([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+        });
+
+        std::vector<double> rounds_us;
+        auto start = Clock::now();
+        for (size_t ix = 0; ix < rounds; ix++)
+        {
+            auto before = Clock::now();
+            manager->addWorker(4);
+            manager->removeWorker(4);
+            rounds_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - before).count());
+        }
+        double seconds = secondsSince(start);
+        stop = true;
+        producer.join();
+        manager->stop();
+
+        json.beginObject();
+        json.value("mode", modeName(stealing));
+        json.value("rounds", static_cast<double>(rounds));
+        json.value("workers_per_round", 4);
+        json.value("rounds_per_second", rounds / seconds);
+        json.value("tasks_run", static_cast<double>(done));
+        json.beginObject("round");
+        writePercentiles(json, rounds_us);
+        json.endObject();
+        json.endObject();
+    }
+    json.endArray();
+}
+
+/**
+ * Set when a task accepted by submit() was neither run nor handed back
+ */
+bool lostTasks = false;
+
+/**
+ * A producer submitting in a loop while the manager is stopped with ABORT:
+ * every task accepted must be run or returned by stop().  Checks the ring
+ * (bounded) and the deque (unbounded) fast paths.
+ */
+void stoprace(Json &json, bool quick)
+{
+    const size_t rounds = quick ? 200 : 2000;
+
+    json.beginArray("stoprace");
+    for (bool stealing : {false, true})
+    {
+        for (bool bounded : {false, true})
+        {
+            size_t lost = 0;
+            size_t accepted = 0;
+            auto start = Clock::now();
+            for (size_t ix = 0; ix < rounds; ix++)
+            {
+                auto manager = newManager(stealing, 2, bounded ? (1 << 20) : 0);
+                std::atomic<size_t> ran(0);
+                std::atomic<size_t> added(0);
+                std::thread producer([&]() {
+                    try
+                    {
+                        for (;;)
+                        {
+                            manager->submit([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); });
+                            added.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                    catch (...)
+                    {
+                        // stopped
+                    }
+                });
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                std::vector<std::shared_ptr<Runnable>> left = manager->stop(ThreadManager::ABORT);
+                producer.join();
+                accepted += added;
+                lost += added - ran - left.size();
+            }
+            double seconds = secondsSince(start);
+            lostTasks = lostTasks || lost != 0;
+
+            json.beginObject();
+            json.value("mode", modeName(stealing));
+            json.flag("bounded", bounded);
+            json.value("rounds", static_cast<double>(rounds));
+            json.value("accepted", static_cast<double>(accepted));
+            json.value("lost", static_cast<double>(lost));
+            json.value("seconds", seconds);
+            json.endObject();
+        }
+    }
+    json.endArray();
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(Json &json, bool quick);
+};
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = false;
+    const char *only = nullptr;
+    for (int ix = 1; ix < argc; ix++)
+    {
+        if (strcmp(argv[ix], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else if (strcmp(argv[ix], "--only") == 0 && ix + 1 < argc)
+        {
+            only = argv[++ix];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--quick] [--only throughput|latency|backpressure|expiration|churn|stoprace]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const Benchmark benchmarks[] = {
+        {"throughput", &throughput},
+        {"latency", &latency},
+        {"backpressure", &backpressure},
+        {"expiration", &expiration},
+        {"churn", &churn},
+        {"stoprace", &stoprace},
+    };
+
+    Json json;
+    json.beginObject();
+    json.value("hardware_concurrency", static_cast<double>(std::thread::hardware_concurrency()));
+    json.flag("quick", quick);
+    for (const Benchmark &benchmark : benchmarks)
+    {
+        if (!only || strcmp(only, benchmark.name) == 0)
+        {
+            benchmark.run(json, quick);
+        }
+    }
+    json.endObject();
+
+    printf("%s\n", json.str().c_str());
+    return lostTasks ? 1 : 0;
+}